@@ -26,281 +26,346 @@
 */
 
 #include <math.h>
+#include <pthread.h>
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
 #include <time.h>
 
-/*  Astronomical constants  */
+#include "moon.h"
+#include "astro_kern.h"
+#include "phasetab.h"
 
-#define epoch 2444238.5 /* 1980 January 0.0 */
-
-/*  Constants defining the Sun's apparent orbit  */
-
-#define elonge 278.833540 /* Ecliptic longitude of the Sun at epoch 1980.0 */
-#define elongp 282.596403 /* Ecliptic longitude of the Sun at perigee */
-#define eccent 0.016718 /* Eccentricity of Earth's orbit */
+/*
+ * Accuracy tiers.  ASTRO_EXACT is the original code.  ASTRO_FAST takes
+ * sines and cosines of angles in degrees from polynomials, reducing the
+ * angle exactly in degrees, and solves Kepler's equation with two Newton
+ * steps.  ASTRO_APPROX does the same in single precision.  The
+ * tier is ASTRO_TIER unless $MOON_TIER or astro_set_tier() says otherwise.
+ */
+#ifndef ASTRO_TIER
+#define ASTRO_TIER ASTRO_EXACT
+#endif
 
-/*  Elements of the Moon's orbit, epoch 1980.0  */
+static pthread_once_t tieronce = PTHREAD_ONCE_INIT;
+static enum astro_tier curtier;
 
-#define synmonth 29.53058868 /* Synodic month (new Moon to new Moon) */
+static void
+tierinit(void)
+{
+  char *env = getenv("MOON_TIER");
+
+  curtier = ASTRO_TIER;
+  if (env && !strcmp(env, "exact"))
+    curtier = ASTRO_EXACT;
+  else if (env && !strcmp(env, "fast"))
+    curtier = ASTRO_FAST;
+  else if (env && !strcmp(env, "approx"))
+    curtier = ASTRO_APPROX;
+}
 
-/*  Handy mathematical functions  */
+static enum astro_tier
+tier(void)
+{
+  pthread_once(&tieronce, tierinit);
+  return curtier;
+}
 
-#define abs(x) ((x) < 0 ? (-(x)) : (x)) /* Absolute val */
-#define fixangle(a) ((a)-360.0 * (floor((a) / 360.0))) /* Fix angle	  */
-#define torad(d) ((d) * (M_PI / 180.0)) /* Deg->Rad	  */
-#define todeg(d) ((d) * (180.0 / M_PI)) /* Rad->Deg	  */
-#define dsin(x) (sin(torad((x)))) /* Sin from deg */
-#define dcos(x) (cos(torad((x)))) /* Cos from deg */
+void astro_set_tier(enum astro_tier t)
+{
+  pthread_once(&tieronce, tierinit);
+  curtier = t;
+}
 
 /*
- * JYEAR  --  Convert Julian date to year, month, day, which are
- *	       returned via integer pointers to integers.
+ * Instruction set variants of the kernels.  On x86-64 the Makefile builds
+ * astro_kern.c for AVX2 with FMA and for AVX-512 as well as for the
+ * baseline, and defines ASTRO_MULTIISA.  The best variant the CPU supports
+ * is used unless $MOON_ISA or astro_set_isa() names another.
  */
+#ifdef ASTRO_MULTIISA
+static int
+has_avx2(void)
+{
+  __builtin_cpu_init();
+  return __builtin_cpu_supports("avx2") && __builtin_cpu_supports("fma");
+}
+
+static int
+has_avx512(void)
+{
+  return has_avx2() && __builtin_cpu_supports("avx512f")
+      && __builtin_cpu_supports("avx512dq") && __builtin_cpu_supports("avx512vl");
+}
+#endif
+
+static const struct isa {
+  const char *name;
+  const struct astro_kern *kern;
+  int (*supported)(void);
+} isas[] = {
+#ifdef ASTRO_MULTIISA
+  { "avx512", &astro_kern_avx512, has_avx512 },
+  { "avx2", &astro_kern_avx2, has_avx2 },
+#endif
+  { "baseline", &astro_kern_base, NULL },
+};
+
+#define NISA (sizeof(isas) / sizeof(*isas))
+
+static pthread_once_t isaonce = PTHREAD_ONCE_INIT;
+static const struct isa *curisa;
+
+static const struct isa *
+findisa(const char *name)
+{
+  size_t i;
+
+  for (i = 0; i < NISA; i++)
+    if ((!name || !strcmp(name, isas[i].name))
+        && (!isas[i].supported || isas[i].supported()))
+      return &isas[i];
+  return NULL;
+}
 
 static void
-jyear(double td, int *yy, int *mm, int *dd)
+isainit(void)
 {
-  double j, d, y, m;
-
-  td += 0.5; /* Astronomical to civil */
-  j = floor(td);
-  j -= 1721119.0;
-  y = floor(((4 * j) - 1) / 146097.0);
-  j = (j * 4.0) - (1.0 + (146097.0 * y));
-  d = floor(j / 4.0);
-  j = floor(((4.0 * d) + 3.0) / 1461.0);
-  d = ((4.0 * d) + 3.0) - (1461.0 * j);
-  d = floor((d + 4.0) / 4.0);
-  m = floor(((5.0 * d) - 3) / 153.0);
-  d = (5.0 * d) - (3.0 + (153.0 * m));
-  d = floor((d + 5.0) / 5.0);
-  y = (100.0 * y) + j;
-  if (m < 10.0)
-    m += 3;
-  else {
-    m -= 9;
-    y++;
-  }
-  *yy = y;
-  *mm = m;
-  *dd = d;
+  char *env;
+
+  if ((env = getenv("MOON_ISA")) && !(curisa = findisa(env)))
+    (void)fprintf(stderr, "MOON_ISA: `%s' is not available here\n", env);
+  if (!curisa)
+    curisa = findisa(NULL);
+}
+
+static const struct astro_kern *
+kern(void)
+{
+  pthread_once(&isaonce, isainit);
+  return curisa->kern;
 }
 
 /*
- * MEANPHASE  --  Calculates time of the mean new Moon for a given
- *		base date.  This argument K to this function is
- *		the precomputed synodic month index, given by:
- *
- *			K = (year - 1900) * 12.3685
- *
- *		where year is expressed as a year and fractional year.
+ * ASTRO_SET_ISA  --  Use the named variant of the kernels, or the best
+ *		one if name is NULL.  Fails if this build or this CPU lacks
+ *		the variant.
  */
-static double
-meanphase(double sdate, double k)
+int astro_set_isa(const char *name)
 {
-  double t;
+  const struct isa *p = findisa(name);
 
-  /* Time in Julian centuries from 1900 January 0.5 */
-  t = (sdate - 2415020.0) / 36525;
+  if (!p)
+    return -1;
+  pthread_once(&isaonce, isainit);
+  curisa = p;
+  return 0;
+}
 
-  return 2415020.75933 + synmonth * k
-      + 0.0001178 * (t * t)
-      - 0.000000155 * (t * t * t)
-      + 0.00033 * dsin(166.56 + 132.87 * t - 0.009173 * (t * t));
+/* ASTRO_ISA  --  Name of the variant of the kernels in use */
+const char *astro_isa(void)
+{
+  kern();
+  return curisa->name;
+}
+
+
+/*
+ * LUNATION  --  Lunation number of a Julian date: the K of the last
+ *		mean new Moon at or before it.  The secular and periodic
+ *		terms of the mean phase stay under a day for thousands of
+ *		years either side of 1900, so dividing by the synodic month
+ *		is never more than one lunation out.
+ */
+long lunation(double jd)
+{
+  double k = floor((jd - 2415020.75933) / synmonth);
+
+  if (kern()->meanphase(tier(), k) > jd)
+    k--;
+  else if (kern()->meanphase(tier(), k + 1) <= jd)
+    k++;
+  return k;
 }
 
 /*
  * TRUEPHASE  --  Given a K value used to determine the
  *		mean phase of the new moon, and a phase
  *		selector (0.0, 0.25, 0.5, 0.75), obtain
- *		the true, corrected phase time.
+ *		the true, corrected phase time.  NaN for
+ *		any other selector.
  */
 static double
 truephase(double k, double pha)
 {
-  double t, t2, t3, pt, m, mprime, f;
-  int apcor = 0;
-
-  k += pha; /* Add phase to new moon time */
-  t = k / 1236.85; /* Time in Julian centuries from
-                      1900 January 0.5 */
-  t2 = t * t; /* Square for frequent use */
-  t3 = t2 * t; /* Cube for frequent use */
-  pt = 2415020.75933 /* Mean time of phase */
-      + synmonth * k
-      + 0.0001178 * t2
-      - 0.000000155 * t3
-      + 0.00033 * dsin(166.56 + 132.87 * t - 0.009173 * t2);
-
-  m = 359.2242 /* Sun's mean anomaly */
-      + 29.10535608 * k
-      - 0.0000333 * t2
-      - 0.00000347 * t3;
-  mprime = 306.0253 /* Moon's mean anomaly */
-      + 385.81691806 * k
-      + 0.0107306 * t2
-      + 0.00001236 * t3;
-  f = 21.2964 /* Moon's argument of latitude */
-      + 390.67050646 * k
-      - 0.0016528 * t2
-      - 0.00000239 * t3;
-  if ((pha < 0.01) || (abs(pha - 0.5) < 0.01)) {
-
-    /* Corrections for New and Full Moon */
-
-    pt += (0.1734 - 0.000393 * t) * dsin(m)
-        + 0.0021 * dsin(2 * m)
-        - 0.4068 * dsin(mprime)
-        + 0.0161 * dsin(2 * mprime)
-        - 0.0004 * dsin(3 * mprime)
-        + 0.0104 * dsin(2 * f)
-        - 0.0051 * dsin(m + mprime)
-        - 0.0074 * dsin(m - mprime)
-        + 0.0004 * dsin(2 * f + m)
-        - 0.0004 * dsin(2 * f - m)
-        - 0.0006 * dsin(2 * f + mprime)
-        + 0.0010 * dsin(2 * f - mprime)
-        + 0.0005 * dsin(m + 2 * mprime);
-    apcor = 1;
-  } else if ((abs(pha - 0.25) < 0.01 || (abs(pha - 0.75) < 0.01))) {
-    pt += (0.1721 - 0.0004 * t) * dsin(m)
-        + 0.0021 * dsin(2 * m)
-        - 0.6280 * dsin(mprime)
-        + 0.0089 * dsin(2 * mprime)
-        - 0.0004 * dsin(3 * mprime)
-        + 0.0079 * dsin(2 * f)
-        - 0.0119 * dsin(m + mprime)
-        - 0.0047 * dsin(m - mprime)
-        + 0.0003 * dsin(2 * f + m)
-        - 0.0004 * dsin(2 * f - m)
-        - 0.0006 * dsin(2 * f + mprime)
-        + 0.0021 * dsin(2 * f - mprime)
-        + 0.0003 * dsin(m + 2 * mprime)
-        + 0.0004 * dsin(m - 2 * mprime)
-        - 0.0003 * dsin(2 * m + mprime);
-    if (pha < 0.5)
-      /* First quarter correction */
-      pt += 0.0028 - 0.0004 * dcos(m) + 0.0003 * dcos(mprime);
-    else
-      /* Last quarter correction */
-      pt += -0.0028 + 0.0004 * dcos(m) - 0.0003 * dcos(mprime);
-    apcor = 1;
-  }
-  if (!apcor) {
-    (void)fprintf(stderr,
-        "TRUEPHASE called with invalid phase selector.\n");
-    abort();
-  }
-  return pt;
+  if (!((pha < 0.01) || (abs(pha - 0.5) < 0.01)
+      || (abs(pha - 0.25) < 0.01 || (abs(pha - 0.75) < 0.01))))
+    return NAN;
+  return kern()->truephase(tier(), k, pha);
 }
 
 /*
- * PHASEHUNT2  --  Find time of phases of the moon which surround
- *		the current date.  Two phases are found.
+ * TRUEPHASE_ALL  --  Times of the new moon, first quarter, full moon and
+ *		last quarter of lunation K, in that order.  Still one
+ *		kernel truephase() a quarter: each is at K + 0.25 q, so
+ *		the centuries and the three anomalies differ between
+ *		them, and stepping them on from the new moon's would move
+ *		the times in the last bits from what truephase() gives.
+ *		Only the tier and kernel lookups and the selector checks
+ *		are shared.
  */
-void phasehunt2(double sdate, double phases[2], int *which)
+void truephase_all(double k, double out[4])
 {
-  double adate = sdate - 45, k1, k2, nt1, nt2;
-  int yy, mm, dd;
+  const struct astro_kern *kn = kern();
+  enum astro_tier t = tier();
+  int q;
 
-  jyear(adate, &yy, &mm, &dd);
-  k1 = floor((yy + ((mm - 1) * (1.0 / 12.0)) - 1900) * 12.3685);
+  for (q = 0; q < 4; q++)
+    out[q] = kn->truephase(t, k, q * 0.25);
+}
 
-  for (adate = nt1 = meanphase(adate, k1);; nt1 = nt2, k1++) {
-    adate += synmonth;
-    nt2 = meanphase(adate, k2 = k1 + 1);
-    if (nt1 <= sdate && nt2 > sdate)
-      break;
+/*
+ * CURSOR_LOAD  --  Point the cursor at lunation k.
+ */
+static void
+cursor_load(struct phase_cursor *pc, double k)
+{
+  pc->k = k;
+  truephase_all(k, pc->ev);
+  pc->ev[4] = truephase(k + 1, 0.0);
+}
+
+/*
+ * PHASE_CURSOR_SEEK  --  Find the phases of the moon which surround
+ *		sdate from scratch.
+ */
+void phase_cursor_seek(struct phase_cursor *pc, double sdate)
+{
+  cursor_load(pc, lunation(sdate));
+
+  /* The true new moon can be hours either side of the mean */
+  while (sdate < pc->ev[0])
+    cursor_load(pc, pc->k - 1);
+  while (sdate >= pc->ev[4])
+    cursor_load(pc, pc->k + 1);
+  for (pc->which = 0; sdate >= pc->ev[pc->which + 1]; pc->which++) ;
+}
+
+/*
+ * PHASE_CURSOR_ADVANCE  --  Move the cursor to sdate.  Moving within the
+ *		current lunation or into the next one reuses what the
+ *		cursor has; anything else seeks from scratch.
+ */
+void phase_cursor_advance(struct phase_cursor *pc, double sdate)
+{
+  if (sdate >= pc->ev[4] && sdate < pc->ev[4] + synmonth) {
+    pc->k++;
+    pc->ev[0] = pc->ev[4];
+    pc->ev[1] = truephase(pc->k, 0.25);
+    pc->ev[2] = truephase(pc->k, 0.5);
+    pc->ev[3] = truephase(pc->k, 0.75);
+    pc->ev[4] = truephase(pc->k + 1, 0.0);
   }
-  *which = 0;
-  phases[0] = truephase(k1, 0.0);
-  phases[1] = truephase(k1, 0.25);
-  if (phases[1] <= sdate) {
-    *which += 1;
-    phases[0] = phases[1];
-    if ((phases[1] = truephase(k1, 0.5)) <= sdate) {
-      phases[0] = phases[1];
-      *which += 1;
-      if ((phases[1] = truephase(k1, 0.75)) <= sdate) {
-        phases[0] = phases[1];
-        phases[1] = truephase(k2, 0.0);
-        *which += 1;
-      }
-    }
+  if (!(sdate >= pc->ev[0] && sdate < pc->ev[4])) {
+    phase_cursor_seek(pc, sdate);
+    return;
   }
+  for (pc->which = 0; sdate >= pc->ev[pc->which + 1]; pc->which++) ;
 }
 
 /*
- * KEPLER  --	Solve the equation of Kepler.
+ * PHASEHUNT2  --  Find time of phases of the moon which surround
+ *		the current date.  Two phases are found.  Dates covered
+ *		by the precomputed table are looked up there.
  */
-static double
-kepler(double m, double ecc)
+void phasehunt2(double sdate, double phases[2], int *which)
 {
-  double e = m = torad(m), delta;
+  struct phase_cursor pc;
 
-  do {
-    delta = e - ecc * sin(e) - m;
-    e -= delta / (1 - ecc * cos(e));
-  } while (abs(delta) > 1E-6);
-  return e;
+  if (!phasetab_hunt(phasetab_default(), sdate, phases, which))
+    return;
+
+  phase_cursor_seek(&pc, sdate);
+  phases[0] = pc.ev[pc.which];
+  phases[1] = pc.ev[pc.which + 1];
+  *which = pc.which;
 }
 
 /*
- * PHASE  --  Calculate phase of moon as a fraction:
+ * EPHEMERIS  --  Calculate the phase of the moon, and the positions of
+ *		the Sun and Moon it is derived from:
  *
  *	The argument is the time for which the phase is requested,
- *	expressed as a Julian date and fraction.  Returns the terminator
- *	phase angle as a percentage of a full circle (i.e., 0 to 1),
- *	and stores into pointer arguments the illuminated fraction of
- *      the Moon's disc, the Moon's age in days and fraction, the
- *	distance of the Moon from the centre of the Earth, and the
- *	angular diameter subtended by the Moon as seen by an observer
- *	at the centre of the Earth.
+ *	expressed as a Julian date and fraction.  Fills in the terminator
+ *	phase angle as a percentage of a full circle (i.e., 0 to 1), the
+ *	illuminated fraction of the Moon's disc, the Moon's age in days
+ *	and fraction, the distance of the Moon from the centre of the
+ *	Earth, and the angular diameter subtended by the Moon as seen by
+ *	an observer at the centre of the Earth, and the same two for the
+ *	Sun.
+ */
+void ephemeris(double pdate, struct moon_ephem *e)
+{
+  kern()->ephemeris(tier(), pdate, e);
+}
+
+/*
+ * PHASE  --  Calculate phase of moon as a fraction: the terminator
+ *	phase angle from ephemeris(), storing the illuminated fraction
+ *	and age in days into the pointer arguments.
  *
  * pphase:		Illuminated fraction
  * mage:		Age of moon in days
  */
 double phase(double pdate, double *pphase, double *mage)
 {
-  double Day, M, Ec, Lambdasun, ml, MM, Ev, Ae, MmP, lP, lPP, MoonAge;
-
-  /* Calculation of the Sun's position */
-
-  Day = pdate - epoch; /* Date within epoch */
-  M = fixangle(fixangle((360 / 365.2422) * Day) + elonge - elongp); /* Convert from perigee
-                                     co-ordinates to epoch 1980.0 */
-  Ec = kepler(M, eccent); /* Solve equation of Kepler */
-  Ec = sqrt((1 + eccent) / (1 - eccent)) * tan(Ec / 2);
-  Ec = 2 * todeg(atan(Ec)); /* True anomaly */
-  Lambdasun = fixangle(Ec + elongp); /* Sun's geocentric ecliptic longitude */
-
-  /* Moon's mean longitude */
-  ml = fixangle(13.1763966 * Day + 64.975464); /* Moon's mean lonigitude at the epoch */
-
-  /* Moon's mean anomaly */
-  MM = fixangle(ml - 0.1114041 * Day - 349.383063); /* 349:  Mean longitude of the perigee at the epoch */
-
-  /* Evection */
-  Ev = 1.2739 * sin(torad(2 * (ml - Lambdasun) - MM));
+  struct moon_ephem e;
 
-  /* Annual equation */
-  Ae = 0.1858 * sin(torad(M));
-
-  /* Corrected anomaly */
-  MmP = MM + Ev - Ae - (0.37 * sin(torad(M)));
-
-  /* Corrected longitude */
-  lP = ml + Ev + (6.2886 * sin(torad(MmP))) - Ae + (0.214 * sin(torad(2 * MmP)));
-
-  /* True longitude */
-  lPP = lP + (0.6583 * sin(torad(2 * (lP - Lambdasun))));
-
-  /* Age of the Moon in degrees */
-  MoonAge = lPP - Lambdasun;
+  ephemeris(pdate, &e);
+  *pphase = e.illum;
+  *mage = e.age;
+  return e.phase;
+}
 
-  *pphase = (1 - cos(torad(MoonAge))) / 2;
-  *mage = synmonth * (fixangle(MoonAge) / 360.0);
-  return fixangle(MoonAge) / 360.0;
+/*
+ * PHASEINDEX  --  Which of the eight named phases the moon is in, given
+ *		the illuminated fraction and age from phase().
+ */
+int phaseindex(double ilumfrac, double mage)
+{
+  if      (ilumfrac < 0.04) return 0;
+  else if (ilumfrac > 0.96) return 4;
+  else if (ilumfrac > 0.46 && ilumfrac < 0.54) return (mage > halfmonth) ? 6 : 2;
+  else if (ilumfrac > 0.54 && ilumfrac < 0.96) return (mage > halfmonth) ? 5 : 3;
+  else    return (mage > halfmonth) ? 7 : 1;
 }
 
+/*
+ * PHASE_BATCH  --  Calculate the phase of the moon for N dates.
+ *
+ *	Equivalent to calling phase() on each jd[i], storing the terminator
+ *	phase in frac[i], the illuminated fraction in illum[i] and the age in
+ *	days in age[i], at the current tier.  At ASTRO_EXACT results agree
+ *	with phase() to within 1e-12 in the phase and illuminated fraction
+ *	and 1e-10 days in age (the phase is compared modulo one turn, as it
+ *	wraps at new moon); at the other tiers they are the same.
+ */
+void phase_batch(const double *jd, size_t n, double *frac, double *illum, double *age)
+{
+  double day[BATCH], f[BATCH], il[BATCH], ag[BATCH];
+  const struct astro_kern *k = kern();
+  enum astro_tier t = tier();
+  size_t i, j, w;
+
+  for (i = 0; i < n; i += w) {
+    w = (n - i < BATCH) ? n - i : BATCH;
+    for (j = 0; j < BATCH; j++)
+      day[j] = jd[i + ((j < w) ? j : w - 1)] - epoch;
+    k->phase_block(t, day, f, il, ag);
+    for (j = 0; j < w; j++) {
+      frac[i + j] = f[j];
+      illum[i + j] = il[j];
+      age[i + j] = ag[j];
+    }
+  }
+}
@@ -0,0 +1,632 @@
+/* astro_kern - the astronomical kernels, built once per instruction set
+** See LICENSE
+*/
+
+/*
+ * Everything in here is arithmetic on its arguments, which lets the Makefile
+ * compile this file several times with different -m flags (and ASTRO_KERN
+ * set to the name of the copy) and astro.c choose the copy the CPU can run.
+ * The code is the same in each; only the instructions the compiler may use
+ * differ.
+ */
+
+#include <math.h>
+
+#include "astro_kern.h"
+
+#ifndef ASTRO_KERN
+#define ASTRO_KERN astro_kern_base
+#endif
+
+/*
+ * QUADRANT  --  Sine and cosine from s and c, the sine and cosine of what
+ *		is left of an angle after q quarter turns are taken away.
+ *		Odd quadrants swap them, the upper two negate the sine and
+ *		the middle two the cosine, all by arithmetic rather than by
+ *		branching, so that the lanes of a SIMD loop never disagree.
+ */
+static inline void
+quadrant(double q, double s, double c, double *ps, double *pc)
+{
+  double qm = q - 4.0 * vround(q * 0.25 - 0.375), hi = vround(qm * 0.5 - 0.25), odd = qm - 2.0 * hi;
+
+  *ps = (s * (1.0 - odd) + c * odd) * (1.0 - 2.0 * hi);
+  *pc = (c * (1.0 - odd) + s * odd) * (1.0 - 2.0 * (odd - hi) * (odd - hi));
+}
+
+/*
+ * FSINCOS  --  Sine and cosine of a (degrees) for ASTRO_FAST.  Reduced by
+ *		quarter turns, which is exact in degrees, then the Taylor
+ *		series to the 11th power, good to about 1e-10, evaluated in
+ *		two halves to shorten the dependency chain.
+ */
+static inline void
+fsincos(double a, double *ps, double *pc)
+{
+  double q = vround(a * (1 / 90.0)), r = torad(a - 90 * q), z = r * r, z2 = z * z, s, c;
+
+  s = r + r * z * ((-1 / 6.0 + z * (1 / 120.0))
+      + z2 * ((-1 / 5040.0 + z * (1 / 362880.0)) + z2 * (-1 / 39916800.0)));
+  c = 1 + z * ((-1 / 2.0 + z * (1 / 24.0))
+      + z2 * ((-1 / 720.0 + z * (1 / 40320.0)) + z2 * (-1 / 3628800.0)));
+  quadrant(q, s, c, ps, pc);
+}
+
+/*
+ * ASINCOS  --  Sine and cosine of a (degrees) for ASTRO_APPROX: FSINCOS
+ *		in single precision, with the series cut at the 8th power
+ *		to match.  Only the reduction to a quarter turn is done in
+ *		double, so large angles keep their fractional degrees.
+ */
+static inline void
+asincos(double a, double *ps, double *pc)
+{
+  double q = vround(a * (1 / 90.0));
+  float r = torad((float)(a - 90 * q)), z = r * r, s, c;
+
+  s = r + r * z * (-1 / 6.0f + z * (1 / 120.0f - z * (1 / 5040.0f)));
+  c = 1 + z * (-1 / 2.0f + z * (1 / 24.0f + z * (-1 / 720.0f + z * (1 / 40320.0f))));
+  quadrant(q, s, c, ps, pc);
+}
+
+/*
+ * TSINCOS  --  Sine and cosine of a (degrees) at tier t.
+ */
+static inline void
+tsincos(enum astro_tier t, double a, double *ps, double *pc)
+{
+  switch (t) {
+  case ASTRO_FAST:
+    fsincos(a, ps, pc);
+    break;
+  case ASTRO_APPROX:
+    asincos(a, ps, pc);
+    break;
+  default:
+    *ps = dsin(a);
+    *pc = dcos(a);
+  }
+}
+
+static inline double
+tsin(enum astro_tier t, double a)
+{
+  double s, c;
+
+  if (t == ASTRO_EXACT)
+    return dsin(a);
+  tsincos(t, a, &s, &c);
+  return s;
+}
+
+static inline double
+tcos(enum astro_tier t, double a)
+{
+  double s, c;
+
+  if (t == ASTRO_EXACT)
+    return dcos(a);
+  tsincos(t, a, &s, &c);
+  return c;
+}
+
+/*
+ * MEANPHASE  --  Time of the mean new Moon of lunation K, counted
+ *		from the first new Moon of 1900.
+ */
+static double
+meanphase(enum astro_tier tr, double k)
+{
+  double t = k / 1236.85; /* Time in Julian centuries from
+                             1900 January 0.5 */
+
+  return 2415020.75933 + synmonth * k
+      + 0.0001178 * (t * t)
+      - 0.000000155 * (t * t * t)
+      + 0.00033 * tsin(tr, 166.56 + 132.87 * t - 0.009173 * (t * t));
+}
+
+/*
+ * Periodic terms of the true phase.  Each term is a coefficient times the
+ * sine of a sum of small multiples of three angles: the Sun's mean anomaly
+ * m, the Moon's mean anomaly mprime and the Moon's argument of latitude f.
+ * Only the sine and cosine of each base angle are computed; the multiples
+ * and sums follow from the angle addition formulas.
+ */
+struct pterm {
+  double coef;
+  signed char m, mprime, f;
+};
+
+/* Corrections for New and Full Moon */
+static const struct pterm newfull[] = {
+  { 0.1734, 1, 0, 0 }, /* Coefficient decreases by 0.000393 t */
+  { 0.0021, 2, 0, 0 },
+  { -0.4068, 0, 1, 0 },
+  { 0.0161, 0, 2, 0 },
+  { -0.0004, 0, 3, 0 },
+  { 0.0104, 0, 0, 2 },
+  { -0.0051, 1, 1, 0 },
+  { -0.0074, 1, -1, 0 },
+  { 0.0004, 1, 0, 2 },
+  { -0.0004, -1, 0, 2 },
+  { -0.0006, 0, 1, 2 },
+  { 0.0010, 0, -1, 2 },
+  { 0.0005, 1, 2, 0 },
+};
+
+/* Corrections for First and Last Quarter */
+static const struct pterm quarter[] = {
+  { 0.1721, 1, 0, 0 }, /* Coefficient decreases by 0.0004 t */
+  { 0.0021, 2, 0, 0 },
+  { -0.6280, 0, 1, 0 },
+  { 0.0089, 0, 2, 0 },
+  { -0.0004, 0, 3, 0 },
+  { 0.0079, 0, 0, 2 },
+  { -0.0119, 1, 1, 0 },
+  { -0.0047, 1, -1, 0 },
+  { 0.0003, 1, 0, 2 },
+  { -0.0004, -1, 0, 2 },
+  { -0.0006, 0, 1, 2 },
+  { 0.0021, 0, -1, 2 },
+  { 0.0003, 1, 2, 0 },
+  { 0.0004, 1, -2, 0 },
+  { -0.0003, 2, 1, 0 },
+};
+
+#define MAXMULT 3 /* Largest multiple of an angle in the tables */
+
+/* Cosines and sines of -MAXMULT to MAXMULT times an angle */
+struct multiples {
+  double c[2 * MAXMULT + 1], s[2 * MAXMULT + 1];
+};
+
+#define MCOS(x, j) ((x)->c[MAXMULT + (j)])
+#define MSIN(x, j) ((x)->s[MAXMULT + (j)])
+
+/*
+ * MULTIPLES  --  Fill in the multiples of the angle a (degrees).  One
+ *		sine and cosine, the rest by the angle addition formulas.
+ */
+static void
+multiples(enum astro_tier t, double a, struct multiples *x)
+{
+  int j;
+
+  MCOS(x, 0) = 1;
+  MSIN(x, 0) = 0;
+  tsincos(t, fixangle(a), &MSIN(x, 1), &MCOS(x, 1));
+  for (j = 2; j <= MAXMULT; j++) {
+    MCOS(x, j) = MCOS(x, j - 1) * MCOS(x, 1) - MSIN(x, j - 1) * MSIN(x, 1);
+    MSIN(x, j) = MSIN(x, j - 1) * MCOS(x, 1) + MCOS(x, j - 1) * MSIN(x, 1);
+  }
+  for (j = 1; j <= MAXMULT; j++) {
+    MCOS(x, -j) = MCOS(x, j);
+    MSIN(x, -j) = -MSIN(x, j);
+  }
+}
+
+/*
+ * PERIODIC  --  Sum the n periodic terms in tab, given the multiples of
+ *		m, mprime and f.  The first term's coefficient is replaced
+ *		by c0.
+ */
+static double
+periodic(const struct pterm *tab, int n, double c0, const struct multiples *m,
+    const struct multiples *mprime, const struct multiples *f)
+{
+  double sum = 0, c, s;
+  int i;
+
+  for (i = 0; i < n; i++) {
+    const struct pterm *p = &tab[i];
+
+    /* sin(a + b + c) from the sines and cosines of a, b and c */
+    c = MCOS(m, p->m) * MCOS(mprime, p->mprime) - MSIN(m, p->m) * MSIN(mprime, p->mprime);
+    s = MSIN(m, p->m) * MCOS(mprime, p->mprime) + MCOS(m, p->m) * MSIN(mprime, p->mprime);
+    sum += (i ? p->coef : c0) * (s * MCOS(f, p->f) + c * MSIN(f, p->f));
+  }
+  return sum;
+}
+
+/*
+ * TRUEPHASE  --  Given a K value used to determine the
+ *		mean phase of the new moon, and a phase
+ *		selector (0.0, 0.25, 0.5, 0.75), obtain
+ *		the true, corrected phase time.  The selector
+ *		has been checked by the caller.
+ */
+static double
+truephase(enum astro_tier tr, double k, double pha)
+{
+  double t, t2, t3, pt, m, mprime, f;
+  struct multiples mm, mmprime, mf;
+
+  k += pha; /* Add phase to new moon time */
+  t = k / 1236.85; /* Time in Julian centuries from
+                      1900 January 0.5 */
+  t2 = t * t; /* Square for frequent use */
+  t3 = t2 * t; /* Cube for frequent use */
+  pt = meanphase(tr, k); /* Mean time of phase */
+
+  m = 359.2242 /* Sun's mean anomaly */
+      + 29.10535608 * k
+      - 0.0000333 * t2
+      - 0.00000347 * t3;
+  mprime = 306.0253 /* Moon's mean anomaly */
+      + 385.81691806 * k
+      + 0.0107306 * t2
+      + 0.00001236 * t3;
+  f = 21.2964 /* Moon's argument of latitude */
+      + 390.67050646 * k
+      - 0.0016528 * t2
+      - 0.00000239 * t3;
+  multiples(tr, m, &mm);
+  multiples(tr, mprime, &mmprime);
+  multiples(tr, f, &mf);
+
+  if ((pha < 0.01) || (abs(pha - 0.5) < 0.01)) {
+    pt += periodic(newfull, sizeof(newfull) / sizeof(*newfull),
+        0.1734 - 0.000393 * t, &mm, &mmprime, &mf);
+  } else {
+    pt += periodic(quarter, sizeof(quarter) / sizeof(*quarter),
+        0.1721 - 0.0004 * t, &mm, &mmprime, &mf);
+    if (pha < 0.5)
+      /* First quarter correction */
+      pt += 0.0028 - 0.0004 * MCOS(&mm, 1) + 0.0003 * MCOS(&mmprime, 1);
+    else
+      /* Last quarter correction */
+      pt += -0.0028 + 0.0004 * MCOS(&mm, 1) - 0.0003 * MCOS(&mmprime, 1);
+  }
+  return pt;
+}
+
+#define TIER_STEPS 2 /* Newton steps for Kepler's equation below ASTRO_EXACT */
+
+/*
+ * KEPLER  --	Solve the equation of Kepler.  Below ASTRO_EXACT, take
+ *		TIER_STEPS Newton steps from the mean anomaly.
+ */
+static double
+kepler(enum astro_tier t, double m, double ecc)
+{
+  double e = m = torad(m), delta, s, c;
+  int steps = TIER_STEPS;
+
+  if (t == ASTRO_EXACT) {
+    do {
+      delta = e - ecc * sin(e) - m;
+      e -= delta / (1 - ecc * cos(e));
+    } while (abs(delta) > 1E-6);
+    return e;
+  }
+  while (steps--) {
+    tsincos(t, todeg(e), &s, &c);
+    e -= (e - ecc * s - m) / (1 - ecc * c);
+  }
+  return e;
+}
+
+static inline double vatan(double x);
+
+/*
+ * TRUEANOMALY  --  True anomaly (degrees) from the eccentric anomaly
+ *		e (radians).  Below ASTRO_EXACT the arc tangent is vatan(),
+ *		as close as the library's, which lets phase_block() run it
+ *		across SIMD lanes.
+ */
+static inline double
+halfatan(double x) /* From x = tan(e / 2) */
+{
+  return 2 * todeg(vatan(sqrt((1 + eccent) / (1 - eccent)) * x));
+}
+
+static double
+trueanomaly(enum astro_tier t, double e)
+{
+  double s, c;
+
+  if (t == ASTRO_EXACT) {
+    e = sqrt((1 + eccent) / (1 - eccent)) * tan(e / 2);
+    return 2 * todeg(atan(e));
+  }
+  tsincos(t, todeg(e / 2), &s, &c);
+  return halfatan(s / c);
+}
+
+/*
+ * EPHEM_DAY  --  The body of ephemeris(), at tier t, for Day days from
+ *		the 1980.0 epoch.
+ */
+static void
+ephem_day(enum astro_tier t, double Day, struct moon_ephem *e)
+{
+  double M, Ec, F, Lambdasun, ml, MM, Ev, Ae, MmP, mEc, lP, lPP, MoonAge;
+
+  /* Calculation of the Sun's position */
+
+  M = fixangle(fixangle((360 / 365.2422) * Day) + elonge - elongp); /* Convert from perigee
+                                     co-ordinates to epoch 1980.0 */
+  Ec = kepler(t, M, eccent); /* Solve equation of Kepler */
+  Ec = trueanomaly(t, Ec); /* True anomaly */
+  Lambdasun = fixangle(Ec + elongp); /* Sun's geocentric ecliptic longitude */
+
+  /* Orbital distance factor */
+  F = ((1 + eccent * tcos(t, Ec)) / (1 - eccent * eccent));
+  e->sundist = sunsmax / F; /* Distance to Sun in km */
+  e->sunang = F * sunangsiz; /* Sun's angular size in degrees */
+
+  /* Moon's mean longitude */
+  ml = fixangle(13.1763966 * Day + 64.975464); /* Moon's mean lonigitude at the epoch */
+
+  /* Moon's mean anomaly */
+  MM = fixangle(ml - 0.1114041 * Day - 349.383063); /* 349:  Mean longitude of the perigee at the epoch */
+
+  /* Evection */
+  Ev = 1.2739 * tsin(t, 2 * (ml - Lambdasun) - MM);
+
+  /* Annual equation */
+  Ae = 0.1858 * tsin(t, M);
+
+  /* Corrected anomaly */
+  MmP = MM + Ev - Ae - (0.37 * tsin(t, M));
+
+  /* Correction for the equation of the centre */
+  mEc = 6.2886 * tsin(t, MmP);
+
+  /* Corrected longitude */
+  lP = ml + Ev + mEc - Ae + (0.214 * tsin(t, 2 * MmP));
+
+  /* True longitude */
+  lPP = lP + (0.6583 * tsin(t, 2 * (lP - Lambdasun)));
+
+  /* Age of the Moon in degrees */
+  MoonAge = lPP - Lambdasun;
+
+  e->phase = fixangle(MoonAge) / 360.0;
+  e->illum = (1 - tcos(t, MoonAge)) / 2;
+  e->age = synmonth * e->phase;
+
+  /* Calculate distance of moon from the centre of the Earth */
+  e->moondist = (msmax * (1 - mecc * mecc)) / (1 + mecc * tcos(t, MmP + mEc));
+
+  /* Calculate Moon's angular diameter */
+  e->moonang = mangsiz / (e->moondist / msmax);
+}
+
+static void
+ephem(enum astro_tier t, double pdate, struct moon_ephem *e)
+{
+  ephem_day(t, pdate - epoch, e); /* Date within epoch */
+}
+
+/*
+ * Batch evaluation of PHASE.
+ *
+ * The arithmetic is the same as ephem() above, but the dates are processed
+ * in fixed blocks laid out as one array per intermediate quantity, and the
+ * transcendental functions are replaced by the branch-free kernels below so
+ * that the compiler can run every stage across SIMD lanes (two on baseline
+ * x86-64, four with AVX2).  The Kepler equation is solved with a fixed
+ * number of Newton steps instead of iterating to a tolerance.
+ *
+ * The kernels are only meant for the arguments that occur here: angles of a
+ * few turns at most, expressed in radians.
+ */
+
+#define KEPLER_STEPS 5 /* Newton steps; converged to double for eccent */
+
+#define vfixangle(a) ((a) - 360.0 * vfloor((a) / 360.0))
+
+/*
+ * VSINCOS -- Sine and cosine of x (radians).  The argument is reduced to
+ *	      [-pi/4, pi/4] and fed to the fdlibm kernel polynomials.
+ */
+static inline void vsincos(double x, double *ps, double *pc)
+{
+  double q = vround(x * M_2_PI), r, z, s, c;
+
+  r = (x - q * 1.57079632673412561417e+00) - q * 6.07710050650619224932e-11;
+  z = r * r;
+  s = r + r * z * (-1.66666666666666324348e-01 + z * (8.33333333332248946124e-03
+      + z * (-1.98412698298579493134e-04 + z * (2.75573137070700676789e-06
+      + z * (-2.50507602534068634195e-08 + z * 1.58969099521155010221e-10)))));
+  c = 1.0 - 0.5 * z + z * z * (4.16666666666666019037e-02
+      + z * (-1.38888888888741095749e-03 + z * (2.48015872894767294178e-05
+      + z * (-2.75573143513906633035e-07 + z * (2.08757232129817482790e-09
+      + z * -1.13596475577881948265e-11)))));
+  quadrant(q, s, c, ps, pc);
+}
+
+static inline double vsin(double x)
+{
+  double s, c;
+
+  vsincos(x, &s, &c);
+  return s;
+}
+
+/*
+ * VATAN -- Arc tangent, Cephes reduction and rational approximation.  All
+ *	    three reductions are computed and the right one selected
+ *	    arithmetically, so there are no comparisons for the lanes to
+ *	    disagree on.
+ */
+static inline double vatan(double x)
+{
+  double a = fabs(x), big, mid, y, r, z;
+
+  big = 0.5 - 0.5 * copysign(1.0, 2.41421356237309504880 - a); /* tan(3pi/8) */
+  mid = 0.5 - 0.5 * copysign(1.0, 0.66 - a) - big;
+  y = big * M_PI_2 + mid * M_PI_4;
+  r = big * (-1.0 / (a + (1.0 - big)))
+      + mid * ((a - 1.0) / (a + 1.0))
+      + (1.0 - big - mid) * a;
+  z = r * r;
+  z = z * ((((-8.750608600031904122785e-01 * z - 1.615753718733365076637e+01) * z
+      - 7.500855792314704667340e+01) * z - 1.228866684490136173410e+02) * z
+      - 6.485021904942025371773e+01)
+      / (((((z + 2.485846490142306297962e+01) * z + 1.650270098316988542046e+02) * z
+      + 4.328810604912902668951e+02) * z + 4.853903996359136964868e+02) * z
+      + 1.945506571482613964425e+02);
+  y += r * z + r + (big + 0.5 * mid) * 6.123233995736765886130e-17; /* Low part of pi/2 */
+  return copysign(y, x);
+}
+
+/*
+ * BSINCOS  --  Sine and cosine of the BATCH angles a (degrees) at tier t,
+ *		below ASTRO_EXACT.  A loop for each kernel, so that each
+ *		runs across SIMD lanes.
+ */
+static void bsincos(enum astro_tier t, const double *restrict a, double *restrict s, double *restrict c)
+{
+  int i;
+
+  if (t == ASTRO_APPROX)
+    for (i = 0; i < BATCH; i++)
+      asincos(a[i], &s[i], &c[i]);
+  else
+    for (i = 0; i < BATCH; i++)
+      fsincos(a[i], &s[i], &c[i]);
+}
+
+/*
+ * TIER_BLOCK  --  phase_block() below ASTRO_EXACT: ephem_day() a stage at
+ *		a time across the block, with the same polynomials through
+ *		bsincos() and the same vatan(), so that each date comes out
+ *		just as ephemeris() gives it.
+ */
+static void tier_block(enum astro_tier tr, const double *day,
+    double *restrict frac, double *restrict illum, double *restrict age)
+{
+  double M[BATCH], E[BATCH], Lambdasun[BATCH], ml[BATCH], MM[BATCH], MmP[BATCH], lP[BATCH];
+  double Ev[BATCH], sM[BATCH], a[BATCH], a2[BATCH], s[BATCH], c[BATCH], s2[BATCH];
+  int i, j;
+
+  /* Calculation of the Sun's position */
+  for (i = 0; i < BATCH; i++) {
+    M[i] = vfixangle(vfixangle((360 / 365.2422) * day[i]) + elonge - elongp);
+    E[i] = torad(M[i]);
+  }
+
+  /* Solve equation of Kepler */
+  for (j = 0; j < TIER_STEPS; j++) {
+    for (i = 0; i < BATCH; i++)
+      a[i] = todeg(E[i]);
+    bsincos(tr, a, s, c);
+    for (i = 0; i < BATCH; i++)
+      E[i] -= (E[i] - eccent * s[i] - torad(M[i])) / (1 - eccent * c[i]);
+  }
+
+  /* True anomaly, from tan(E / 2) */
+  for (i = 0; i < BATCH; i++)
+    a[i] = todeg(E[i] / 2);
+  bsincos(tr, a, s, c);
+  for (i = 0; i < BATCH; i++)
+    Lambdasun[i] = vfixangle(halfatan(s[i] / c[i]) + elongp);
+
+  /* Moon's mean longitude and anomaly */
+  for (i = 0; i < BATCH; i++) {
+    ml[i] = vfixangle(13.1763966 * day[i] + 64.975464);
+    MM[i] = vfixangle(ml[i] - 0.1114041 * day[i] - 349.383063);
+    a[i] = 2 * (ml[i] - Lambdasun[i]) - MM[i];
+  }
+
+  /* Evection and annual equation */
+  bsincos(tr, a, Ev, c);
+  bsincos(tr, M, sM, c);
+  for (i = 0; i < BATCH; i++) {
+    Ev[i] *= 1.2739;
+    MmP[i] = MM[i] + Ev[i] - 0.1858 * sM[i] - (0.37 * sM[i]);
+    a2[i] = 2 * MmP[i];
+  }
+
+  /* Corrected and true longitudes */
+  bsincos(tr, MmP, s, c);
+  bsincos(tr, a2, s2, c);
+  for (i = 0; i < BATCH; i++) {
+    lP[i] = ml[i] + Ev[i] + (6.2886 * s[i]) - 0.1858 * sM[i] + (0.214 * s2[i]);
+    a[i] = 2 * (lP[i] - Lambdasun[i]);
+  }
+  bsincos(tr, a, s, c);
+  for (i = 0; i < BATCH; i++)
+    a[i] = lP[i] + (0.6583 * s[i]) - Lambdasun[i]; /* Age of the Moon in degrees */
+
+  bsincos(tr, a, s, c);
+  for (i = 0; i < BATCH; i++) {
+    frac[i] = vfixangle(a[i]) / 360.0;
+    illum[i] = (1 - c[i]) / 2;
+    age[i] = synmonth * frac[i];
+  }
+}
+
+/*
+ * PHASE_BLOCK  --  Phase of the moon for BATCH dates at once, given as
+ *		days from the 1980.0 epoch, at tier tr.  The kernels above
+ *		stand in for the library at ASTRO_EXACT; the other tiers
+ *		go through tier_block().
+ */
+static void phase_block(enum astro_tier tr, const double *day, double *frac, double *illum, double *age)
+{
+  double M[BATCH], E[BATCH], Lambdasun[BATCH], ml[BATCH], MM[BATCH], MoonAge[BATCH];
+  double ecfac = sqrt((1 + eccent) / (1 - eccent));
+  int i, j;
+
+  if (tr != ASTRO_EXACT) {
+    tier_block(tr, day, frac, illum, age);
+    return;
+  }
+
+  /* Calculation of the Sun's position */
+  for (i = 0; i < BATCH; i++) {
+    M[i] = vfixangle(vfixangle((360 / 365.2422) * day[i]) + elonge - elongp);
+    E[i] = torad(M[i]);
+  }
+
+  /* Solve equation of Kepler */
+  for (j = 0; j < KEPLER_STEPS; j++)
+    for (i = 0; i < BATCH; i++) {
+      double s, c;
+
+      vsincos(E[i], &s, &c);
+      E[i] -= (E[i] - eccent * s - torad(M[i])) / (1 - eccent * c);
+    }
+
+  for (i = 0; i < BATCH; i++) {
+    double s, c, Ec;
+
+    vsincos(E[i] / 2, &s, &c);
+    Ec = 2 * todeg(vatan(ecfac * (s / c))); /* True anomaly */
+    Lambdasun[i] = vfixangle(Ec + elongp);
+  }
+
+  /* Moon's mean longitude and anomaly */
+  for (i = 0; i < BATCH; i++) {
+    ml[i] = vfixangle(13.1763966 * day[i] + 64.975464);
+    MM[i] = vfixangle(ml[i] - 0.1114041 * day[i] - 349.383063);
+  }
+
+  /* Evection, annual equation, and the corrected positions */
+  for (i = 0; i < BATCH; i++) {
+    double Ev, Ae, sM, MmP, lP, lPP;
+
+    Ev = 1.2739 * vsin(torad(2 * (ml[i] - Lambdasun[i]) - MM[i]));
+    sM = vsin(torad(M[i]));
+    Ae = 0.1858 * sM;
+    MmP = MM[i] + Ev - Ae - (0.37 * sM);
+    lP = ml[i] + Ev + (6.2886 * vsin(torad(MmP))) - Ae + (0.214 * vsin(torad(2 * MmP)));
+    lPP = lP + (0.6583 * vsin(torad(2 * (lP - Lambdasun[i]))));
+    MoonAge[i] = lPP - Lambdasun[i];
+  }
+
+  for (i = 0; i < BATCH; i++) {
+    double s, c, a = vfixangle(MoonAge[i]);
+
+    vsincos(torad(MoonAge[i]), &s, &c);
+    illum[i] = (1 - c) / 2;
+    age[i] = synmonth * (a / 360.0);
+    frac[i] = a / 360.0;
+  }
+}
+
+const struct astro_kern ASTRO_KERN = { meanphase, truephase, ephem, phase_block };
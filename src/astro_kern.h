@@ -0,0 +1,79 @@
+/* astro_kern - the astronomical kernels, built once per instruction set
+** See LICENSE
+*/
+
+#ifndef ASTRO_KERN_H
+#define ASTRO_KERN_H
+
+#include <math.h>
+
+#include "moon.h"
+
+/*  Astronomical constants  */
+
+#define epoch 2444238.5 /* 1980 January 0.0 */
+
+/*  Constants defining the Sun's apparent orbit  */
+
+#define elonge 278.833540 /* Ecliptic longitude of the Sun at epoch 1980.0 */
+#define elongp 282.596403 /* Ecliptic longitude of the Sun at perigee */
+#define eccent 0.016718 /* Eccentricity of Earth's orbit */
+#define sunsmax 1.495985e8 /* Semi-major axis of Earth's orbit, km */
+#define sunangsiz 0.533128 /* Sun's angular size, degrees, at
+                              semi-major axis distance */
+
+/*  Elements of the Moon's orbit, epoch 1980.0  */
+
+#define mecc 0.054900 /* Eccentricity of the Moon's orbit */
+#define mangsiz 0.5181 /* Moon's angular size at distance a
+                          from Earth */
+#define msmax 384401.0 /* Semi-major axis of Moon's orbit in km */
+#define synmonth 29.53058868 /* Synodic month (new Moon to new Moon) */
+#define halfmonth 14.76529434 /* Half Synodic month (new Moon to full Moon) */
+
+/*  Handy mathematical functions  */
+
+#define abs(x) ((x) < 0 ? (-(x)) : (x)) /* Absolute val */
+#define fixangle(a) ((a)-360.0 * (floor((a) / 360.0))) /* Fix angle	  */
+#define torad(d) ((d) * (M_PI / 180.0)) /* Deg->Rad	  */
+#define todeg(d) ((d) * (180.0 / M_PI)) /* Rad->Deg	  */
+#define dsin(x) (sin(torad((x)))) /* Sin from deg */
+#define dcos(x) (cos(torad((x)))) /* Cos from deg */
+
+#define ROUNDMAGIC 6755399441055744.0 /* 1.5 * 2^52 */
+
+/* VROUND -- Round to nearest integer, |x| < 2^51 */
+static inline double vround(double x)
+{
+  return (x + ROUNDMAGIC) - ROUNDMAGIC;
+}
+
+/*
+ * VFLOOR -- Exact floor, |x| < 2^51: one less than the nearest integer r
+ *	     where x is below it.  x - r is exact, and adding 0 makes -0
+ *	     of it +0, so that only a negative difference takes the one.
+ *	     The sign of x goes on the result, which floor() keeps for -0.
+ */
+static inline double vfloor(double x)
+{
+  double r = vround(x);
+  return copysign(r - (0.5 - 0.5 * copysign(1.0, (x - r) + 0.0)), x);
+}
+
+#define BATCH 64 /* Dates per block of phase_block() */
+
+/*
+ * astro_kern.c is compiled once for each instruction set variant, each
+ * copy defining one of these.  The tier is passed in rather than looked up
+ * so that the kernels have no state of their own.
+ */
+struct astro_kern {
+  double (*meanphase)(enum astro_tier t, double k);
+  double (*truephase)(enum astro_tier t, double k, double pha);
+  void (*ephemeris)(enum astro_tier t, double pdate, struct moon_ephem *e);
+  void (*phase_block)(enum astro_tier t, const double *day, double *frac, double *illum, double *age);
+};
+
+extern const struct astro_kern astro_kern_base, astro_kern_avx2, astro_kern_avx512;
+
+#endif
@@ -0,0 +1,144 @@
+/* bucket - dates at which the moon changes named phase
+** See LICENSE
+**
+** phaseindex() splits each lunation into eight named phases at fixed
+** illuminated fractions.  Solving once for the dates those thresholds are
+** crossed turns classifying a date into a search of the crossings, and a
+** sorted run of dates into a merge.
+*/
+
+#include <stdlib.h>
+
+#include "moon.h"
+#include "bucket.h"
+
+#define STEP 0.25 /* Days; every named phase lasts longer than this */
+
+static int classify(double jd)
+{
+  double ilumfrac, mage;
+
+  phase(jd, &ilumfrac, &mage);
+  return phaseindex(ilumfrac, mage);
+}
+
+static int append(struct bucket_table *bt, size_t *cap, double start, int idx)
+{
+  if (bt->n == *cap) {
+    size_t ncap = *cap ? 2 * *cap : 1024;
+    double *s = realloc(bt->start, ncap * sizeof(*s));
+    unsigned char *i;
+
+    if (!s)
+      return -1;
+    bt->start = s;
+    if (!(i = realloc(bt->idx, ncap)))
+      return -1;
+    bt->idx = i;
+    *cap = ncap;
+  }
+  bt->start[bt->n] = start;
+  bt->idx[bt->n++] = idx;
+  return 0;
+}
+
+/*
+ * BUCKET_BUILD  --  Find where the phase index changes over [jd0, jd1).
+ *		Each crossing is bisected down to adjacent dates, so the
+ *		first date of every segment has that segment's index and
+ *		the date before it has the previous one's.  Returns 0, or
+ *		-1 if out of memory.
+ */
+int bucket_build(struct bucket_table *bt, double jd0, double jd1)
+{
+  double t = jd0, t2, lo, hi, mid;
+  int prev = classify(jd0), i2;
+  size_t cap = 0;
+
+  bt->n = 0;
+  bt->start = NULL;
+  bt->idx = NULL;
+  bt->end = jd1;
+  if (!(jd1 > jd0) || append(bt, &cap, jd0, prev))
+    goto fail;
+
+  while (t < jd1) {
+    t2 = (t + STEP < jd1) ? t + STEP : jd1;
+    if ((i2 = classify(t2)) == prev) {
+      t = t2;
+      continue;
+    }
+    for (lo = t, hi = t2; (mid = lo + (hi - lo) / 2) > lo && mid < hi; )
+      if (classify(mid) == prev)
+        lo = mid;
+      else
+        hi = mid;
+    if (hi >= jd1)
+      break;
+    prev = classify(hi);
+    if (append(bt, &cap, hi, prev))
+      goto fail;
+    t = hi;
+  }
+  return 0;
+
+fail:
+  bucket_free(bt);
+  return -1;
+}
+
+void bucket_free(struct bucket_table *bt)
+{
+  free(bt->start);
+  free(bt->idx);
+  bt->start = NULL;
+  bt->idx = NULL;
+  bt->n = 0;
+}
+
+/*
+ * SEGMENT  --  The segment holding jd, which must be inside the table.
+ */
+static size_t segment(const struct bucket_table *bt, double jd)
+{
+  size_t lo = 0, hi = bt->n, mid;
+
+  while (hi - lo > 1)
+    if (bt->start[mid = lo + (hi - lo) / 2] <= jd)
+      lo = mid;
+    else
+      hi = mid;
+  return lo;
+}
+
+/*
+ * BUCKET_INDEX  --  phaseindex() of the phase at jd.  Dates outside the
+ *		table are computed directly.
+ */
+int bucket_index(const struct bucket_table *bt, double jd)
+{
+  if (!(bt->n && jd >= bt->start[0] && jd < bt->end))
+    return classify(jd);
+  return bt->idx[segment(bt, jd)];
+}
+
+/*
+ * BUCKET_CLASSIFY  --  bucket_index() of n dates.  While the dates are
+ *		ascending this walks the table alongside them.
+ */
+void bucket_classify(const struct bucket_table *bt, const double *jd, size_t n, unsigned char *out)
+{
+  size_t i, s = 0;
+
+  for (i = 0; i < n; i++) {
+    if (!(bt->n && jd[i] >= bt->start[0] && jd[i] < bt->end)) {
+      out[i] = classify(jd[i]);
+      continue;
+    }
+    if (jd[i] < bt->start[s])
+      s = segment(bt, jd[i]);
+    while (s + 1 < bt->n && bt->start[s + 1] <= jd[i])
+      s++;
+    out[i] = bt->idx[s];
+  }
+}
@@ -0,0 +1,26 @@
+/* bucket - dates at which the moon changes named phase
+** See LICENSE
+*/
+
+#ifndef BUCKET_H
+#define BUCKET_H
+
+#include <stddef.h>
+
+/*
+ * From start[i] up to start[i + 1] the moon is in phase index idx[i]; the
+ * last segment runs to end.
+ */
+struct bucket_table {
+  size_t n;
+  double *start;
+  unsigned char *idx;
+  double end;
+};
+
+int bucket_build(struct bucket_table *bt, double jd0, double jd1);
+void bucket_free(struct bucket_table *bt);
+int bucket_index(const struct bucket_table *bt, double jd);
+void bucket_classify(const struct bucket_table *bt, const double *jd, size_t n, unsigned char *out);
+
+#endif
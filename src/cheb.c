@@ -0,0 +1,99 @@
+/* cheb - Chebyshev-interpolated phase of the moon for dense time series
+** See LICENSE
+**
+** phase() is a smooth function of time once the wrap at new moon is taken
+** out, so over a date range it is fitted piecewise: each segment of SEGLEN
+** days holds the Chebyshev coefficients of the unwrapped phase, in turns.
+** The illuminated fraction and age both follow from the phase exactly as
+** phase() derives them, so one polynomial per segment serves all three.
+*/
+
+#include <math.h>
+#include <stdlib.h>
+
+#include "moon.h"
+#include "cheb.h"
+
+#define synmonth 29.53058868 /* Synodic month (new Moon to new Moon) */
+
+/*
+ * CHEB_BUILD  --  Fit the phase of the moon over [jd0, jd1) with segments
+ *		of seglen days.  Returns 0, or -1 if the range is empty or
+ *		the coefficients can't be allocated.
+ */
+int cheb_build(struct cheb_ephem *ce, double jd0, double jd1, double seglen)
+{
+  double f[CHEB_ORDER], node[CHEB_ORDER];
+  size_t s;
+  int j, k;
+
+  if (!(jd1 > jd0) || !(seglen > 0))
+    return -1;
+  ce->start = jd0;
+  ce->seglen = seglen;
+  ce->nseg = ceil((jd1 - jd0) / seglen);
+  ce->end = jd0 + ce->nseg * seglen;
+  if (!(ce->coef = malloc(ce->nseg * CHEB_ORDER * sizeof(double))))
+    return -1;
+
+  for (k = 0; k < CHEB_ORDER; k++)
+    node[k] = cos(M_PI * (k + 0.5) / CHEB_ORDER);
+
+  for (s = 0; s < ce->nseg; s++) {
+    double mid = jd0 + (s + 0.5) * seglen, *c = ce->coef + s * CHEB_ORDER, p, i, a;
+
+    /* Sample at the Chebyshev nodes, unwrapping the phase as we go */
+    for (k = 0; k < CHEB_ORDER; k++) {
+      f[k] = phase(mid + node[k] * seglen / 2, &i, &a);
+      if (k)
+        f[k] += floor(f[k - 1] - f[k] + 0.5);
+    }
+    for (j = 0; j < CHEB_ORDER; j++) {
+      for (p = 0, k = 0; k < CHEB_ORDER; k++)
+        p += f[k] * cos(M_PI * j * (k + 0.5) / CHEB_ORDER);
+      c[j] = p * (j ? 2.0 : 1.0) / CHEB_ORDER;
+    }
+  }
+  return 0;
+}
+
+void cheb_free(struct cheb_ephem *ce)
+{
+  free(ce->coef);
+  ce->coef = NULL;
+  ce->nseg = 0;
+}
+
+/*
+ * CHEB_PHASE  --  Same as phase(), evaluated from the fitted coefficients.
+ *		Dates outside the fitted range are computed exactly.
+ */
+double cheb_phase(const struct cheb_ephem *ce, double pdate, double *pphase, double *mage)
+{
+  double x, b0 = 0, b1 = 0, b2, u;
+  const double *c;
+  size_t s;
+  int j;
+
+  if (!(pdate >= ce->start && pdate < ce->end))
+    return phase(pdate, pphase, mage);
+
+  s = (pdate - ce->start) / ce->seglen;
+  if (s >= ce->nseg)
+    s = ce->nseg - 1;
+  c = ce->coef + s * CHEB_ORDER;
+  x = 2 * (pdate - ce->start - s * ce->seglen) / ce->seglen - 1;
+
+  /* Clenshaw recurrence */
+  for (j = CHEB_ORDER - 1; j > 0; j--) {
+    b2 = b1;
+    b1 = b0;
+    b0 = 2 * x * b1 - b2 + c[j];
+  }
+  u = x * b0 - b1 + c[0];
+  u -= floor(u);
+
+  *pphase = (1 - cos(2 * M_PI * u)) / 2;
+  *mage = synmonth * u;
+  return u;
+}
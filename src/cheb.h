@@ -0,0 +1,24 @@
+/* cheb - Chebyshev-interpolated phase of the moon
+** See LICENSE
+*/
+
+#ifndef CHEB_H
+#define CHEB_H
+
+#include <stddef.h>
+
+#define CHEB_ORDER 12 /* Coefficients per segment */
+#define CHEB_SEGLEN 4.0 /* Default segment length, days */
+
+struct cheb_ephem {
+  double start, end; /* Fitted range, Julian dates */
+  double seglen; /* Days per segment */
+  size_t nseg;
+  double *coef; /* CHEB_ORDER coefficients per segment */
+};
+
+int cheb_build(struct cheb_ephem *ce, double jd0, double jd1, double seglen);
+void cheb_free(struct cheb_ephem *ce);
+double cheb_phase(const struct cheb_ephem *ce, double pdate, double *pphase, double *mage);
+
+#endif
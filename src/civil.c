@@ -0,0 +1,94 @@
+/* civil - UTC calendar dates and Julian dates from Unix time, in integers
+** See LICENSE
+**
+** The proleptic Gregorian calendar repeats every 400 years (146097 days),
+** so a date is found from its place in a 400-year era counted from 1 March,
+** which puts the leap day last.  Everything is 64-bit integer arithmetic:
+** any int64_t time has a date, long before and after what 32 bits hold,
+** and nothing is asked of the C library or the time zone.
+*/
+
+#include <errno.h>
+#include <limits.h>
+
+#include "moon.h"
+
+#define JD1970 2440588 /* Julian day number of 1970-01-01 */
+
+// CIVIL_DAY  --  Days from 1970-01-01 to t, and seconds after midnight
+int64_t civil_day(int64_t t, int32_t *sec)
+{
+  int32_t s = (int32_t)(t % 86400);
+
+  *sec = s < 0 ? s + 86400 : s;
+  return t / 86400 - (s < 0);
+}
+
+// CIVIL_DAYS  --  Days from 1970-01-01 to day d of month m (1 to 12) of year y
+int64_t civil_days(int64_t y, int m, int d)
+{
+  int64_t era, yoe;
+
+  y -= m <= 2;
+  era = (y >= 0 ? y : y - 399) / 400;
+  yoe = y - era * 400;
+  return era * 146097 + yoe * 365 + yoe / 4 - yoe / 100 + (153 * (m > 2 ? m - 3 : m + 9) + 2) / 5 + d - 1 - 719468;
+}
+
+// CIVIL_FROM_DAYS  --  The year, month (1 to 12) and day of day z from 1970
+void civil_from_days(int64_t z, int64_t *y, int *m, int *d)
+{
+  int64_t era, doe, yoe, doy, mp;
+
+  z += 719468;
+  era = (z >= 0 ? z : z - 146096) / 146097;
+  doe = z - era * 146097;
+  yoe = (doe - doe / 1460 + doe / 36524 - doe / 146096) / 365;
+  doy = doe - (365 * yoe + yoe / 4 - yoe / 100);
+  mp = (5 * doy + 2) / 153;
+  *d = (int)(doy - (153 * mp + 2) / 5 + 1);
+  *m = (int)(mp < 10 ? mp + 3 : mp - 9);
+  *y = yoe + era * 400 + (*m <= 2);
+}
+
+// CIVIL_MDAYS  --  Days in month m (1 to 12) of year y
+int civil_mdays(int64_t y, int m)
+{
+  return m == 2 ? 28 + (y % 4 == 0 && (y % 100 != 0 || y % 400 == 0)) : 30 + ((m + (m > 7)) & 1);
+}
+
+// CIVIL_TIME  --  timegm(): seconds from 1970 to tm, its fields in range
+int64_t civil_time(const struct tm *tm)
+{
+  return civil_days(tm->tm_year + 1900LL, tm->tm_mon + 1, tm->tm_mday) * 86400
+         + tm->tm_hour * 3600 + tm->tm_min * 60 + tm->tm_sec;
+}
+
+// CIVIL_TM  --  gmtime_r(): NULL, with errno EOVERFLOW, if tm_year can't hold the year
+struct tm *civil_tm(int64_t t, struct tm *tm)
+{
+  int32_t sec;
+  int64_t z = civil_day(t, &sec), y;
+  int m, d;
+
+  civil_from_days(z, &y, &m, &d);
+  if (y - 1900 > INT_MAX || y - 1900 < INT_MIN)
+    return errno = EOVERFLOW, NULL;
+  tm->tm_year = (int)(y - 1900), tm->tm_mon = m - 1, tm->tm_mday = d;
+  tm->tm_hour = sec / 3600, tm->tm_min = sec / 60 % 60, tm->tm_sec = sec % 60;
+  tm->tm_wday = (int)((z % 7 + 11) % 7); /* 1970-01-01 was a Thursday */
+  tm->tm_yday = (int)(z - civil_days(y, 1, 1));
+  tm->tm_isdst = 0;
+  tm->tm_gmtoff = 0;
+  tm->tm_zone = "GMT";
+  return tm;
+}
+
+// CIVIL_JD  --  Julian date of t, the day number less a half plus the seconds
+double civil_jd(int64_t t)
+{
+  int32_t sec;
+  int64_t z = civil_day(t, &sec);
+
+  return ((z + JD1970) - 0.5) + sec / 86400.0;
+}
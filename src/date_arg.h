@@ -0,0 +1,23 @@
+/* date_arg - a date from the command line, or the reason it isn't one
+** See LICENSE
+*/
+
+#ifndef DATE_ARG_H
+#define DATE_ARG_H
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+
+#include "moon.h"
+
+static inline time_t date_arg(const char *str)
+{
+  time_t t;
+
+  if (date_parse_r(str, &t))
+    dprintf(2, "Unknown date format: `%s`\n", str), exit(2);
+  return t;
+}
+
+#endif
@@ -1,50 +1,409 @@
 // date_parse - parse string dates into internal form
 // See LICENSE
+//
+// The layouts are the strptime(3) formats below, tried in order on one
+// struct tm in the C locale. Rather than go through strptime for each, the
+// string is scanned once, down a tree of the prefixes the formats share:
+// a day of the month and then '/', '-' or a month name picks the layout,
+// and only the optional time at the end is tried more than one way. It
+// fills in the struct tm just as the trial loop would, down to the fields
+// a format sets before it fails, so it takes the same strings and makes
+// the same times of them; test/date_parse.test checks it against strptime.
+//
+//   %d/%m/%Y %T     %d/%m/%Y
+//   %d-%b-%Y %T     %d-%b-%Y
+//   %d %b %Y %r     %d %b %Y %T     %d %b %Y %H:%M     %d %b %Y
+//   %a %b %d %T %Y  %a %b %d
+//
+// and failing those, today at
+//
+//   %r  %T  %H:%M  %b %d %T  %b %d
+//
+// Like strptime, a layout need only match the start of the string, a space
+// matches any run of white space or none, and a number is at most as many
+// digits as keep it in range: "45" is day 4.
+//
+// Before any of those, YYYY-MM-DDTHH:MM:SS[.fff][Z|+hh:mm] (ISO 8601 as in
+// RFC 3339, 'T' or a space between date and time) is read eight bytes at a
+// time. Without a zone it is local time.
 
-#include <stdio.h>
-extern int atol(const char *);
-extern void exit(int);
+#include <errno.h>
+#include <pthread.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
 #include <time.h>
 
-static char *formats[] = {
-  // d/m/y format
-  "%d/%m/%Y %T",
-  "%d/%m/%Y",
-  // d-m-y format
-  "%d-%b-%Y %T",
-  "%d-%b-%Y",
-  // DD MM YY HH:MM:SS
-  "%d %b %Y %r",
-  "%d %b %Y %T",
-  "%d %b %Y %H:%M",
-  "%d %b %Y",
-  // ctime(3) format - zonename
-  "%a %b %d %T %Y",
-  "%a %b %d",
-  NULL
+#include "moon.h"
+
+static const char *days[] = {
+  "Sunday", "Monday", "Tuesday", "Wednesday", "Thursday", "Friday", "Saturday"
 };
 
-static char *ifmts[] = {
-  "%r",
-  "%T",
-  "%H:%M",
-  "%b %d %T",
-  "%b %d",
-  NULL
+static const char *months[] = {
+  "January", "February", "March", "April", "May", "June", "July",
+  "August", "September", "October", "November", "December",
+  "Jan", "Feb", "Mar", "Apr", "May", "Jun", "Jul", "Aug", "Sep", "Oct", "Nov", "Dec", NULL
 };
 
-extern time_t microtime();
+static int space(char c)
+{
+  return c == ' ' || (c >= '\t' && c <= '\r');
+}
+
+static void skip(const char **p)
+{
+  while (space(**p)) ++*p;
+}
+
+// NUM  --  A number from lo to hi of at most n digits, after any white space
+static int num(const char **p, int lo, int hi, int n, int *v)
+{
+  const char *s = *p;
+  int val = 0;
+
+  skip(&s);
+  if (*s < '0' || *s > '9') return 0;
+  do val = 10 * val + *s++ - '0';
+  while (--n > 0 && val * 10 <= hi && *s >= '0' && *s <= '9');
+  if (val < lo || val > hi) return 0;
+  *p = s, *v = val;
+  return 1;
+}
+
+// PREFIX  --  The end of name at the start of s, ignoring case, or NULL
+static const char *prefix(const char *s, const char *name, int n)
+{
+  for (; n && *name && (*s | 0x20) == (*name | 0x20); s++, name++, n--) ;
+  return n && *name ? NULL : s;
+}
+
+// NAME  --  Which of names the string starts with, taking the longest if
+//	     several do; -1 if none does
+static int name(const char **p, const char **names)
+{
+  const char *e, *best = *p;
+  int which = -1;
+
+  for (int i = 0; names[i]; i++)
+    if ((e = prefix(*p, names[i], -1)) && e > best) best = e, which = i;
+  *p = best;
+  return which;
+}
+
+// WEEKDAY  --  A day name, as glibc reads one: the longest, but each
+//		abbreviation found moves the search on past it for the
+//		days after it in the week, so "MonWednesday" is Wednesday
+static int weekday(const char **p)
+{
+  const char *s = *p, *e, *best = NULL;
+
+  for (int i = 0; i < 7; i++) {
+    if ((e = prefix(s, days[i], -1)) && (!best || e > best)) best = e;
+    if ((e = prefix(s, days[i], 3)) && (!best || e > best)) best = e;
+    if (e) s = e;
+  }
+  return best && (*p = best, 1);
+}
+
+// The fields, each stored in tm as soon as it is read, as strptime does
+
+static int mday(const char **p, struct tm *tm)
+{
+  int v;
+
+  return num(p, 1, 31, 2, &v) && (tm->tm_mday = v, 1);
+}
+
+static int mon(const char **p, struct tm *tm)
+{
+  int v;
+
+  return num(p, 1, 12, 2, &v) && (tm->tm_mon = v - 1, 1);
+}
+
+static int month(const char **p, struct tm *tm)
+{
+  int m = name(p, months);
+
+  return m >= 0 && (tm->tm_mon = m % 12, 1);
+}
+
+static int year(const char **p, struct tm *tm)
+{
+  int v;
+
+  return num(p, 0, 9999, 4, &v) && (tm->tm_year = v - 1900, 1);
+}
+
+// HM  --  %H:%M, leaving the hour set if the minutes aren't there
+static int hm(const char **p, struct tm *tm)
+{
+  int v;
+
+  if (!num(p, 0, 23, 2, &v)) return 0;
+  tm->tm_hour = v;
+  if (*(*p)++ != ':' || !num(p, 0, 59, 2, &v)) return 0;
+  tm->tm_min = v;
+  return 1;
+}
+
+// HMS  --  %T, or with ampm %r, stored only if all of it is there
+static int hms(const char **p, struct tm *tm, int ampm)
+{
+  const char *s = *p;
+  int h, m, sec, pm = 0;
+
+  if (!num(&s, ampm, ampm ? 12 : 23, 2, &h) || *s++ != ':' || !num(&s, 0, 59, 2, &m)
+      || *s++ != ':' || !num(&s, 0, 61, 2, &sec))
+    return 0;
+  if (ampm) {
+    skip(&s);
+    if ((s[0] | 0x20) == 'p' && (s[1] | 0x20) == 'm') pm = 12;
+    else if ((s[0] | 0x20) != 'a' || (s[1] | 0x20) != 'm') return 0;
+    s += 2, h = h % 12 + pm;
+  }
+  tm->tm_hour = h, tm->tm_min = m, tm->tm_sec = sec;
+  *p = s;
+  return 1;
+}
+
+// TIME  --  The first of %r, %T or %H:%M there
+static void time_of_day(const char *s, struct tm *tm)
+{
+  const char *r = s;
+
+  if (hms(&r, tm, 1) || (r = s, hms(&r, tm, 0))) return;
+  hm(&s, tm);
+}
 
-time_t date_parse(char *str)
+// DATE  --  A date in the first table of layouts
+static int date(const char *s, struct tm *tm)
 {
-  if (*str == '@')
-    return atol(str + 1);
+  char sep;
 
+  if (mday(&s, tm)) {
+    if ((sep = *s) == '/' || sep == '-') {
+      // d/m/Y or d-b-Y, and maybe a time
+      s++;
+      if (!(sep == '/' ? mon(&s, tm) : month(&s, tm)) || *s++ != sep || !year(&s, tm)) return 0;
+      skip(&s);
+      hms(&s, tm, 0);
+      return 1;
+    }
+    // d b Y, and maybe a time
+    skip(&s);
+    if (!month(&s, tm)) return 0;
+    skip(&s);
+    if (!year(&s, tm)) return 0;
+    skip(&s);
+    time_of_day(s, tm);
+    return 1;
+  }
+  // a b d, and maybe a time and year
+  if (!weekday(&s)) return 0;
+  skip(&s);
+  if (!month(&s, tm)) return 0;
+  skip(&s);
+  if (!mday(&s, tm)) return 0;
+  skip(&s);
+  if (hms(&s, tm, 0)) skip(&s), year(&s, tm);
+  return 1;
+}
+
+// TODAY  --  A time in the second table of layouts
+static int today(const char *s, struct tm *tm)
+{
+  const char *r = s;
+
+  if (hms(&r, tm, 1) || (r = s, hms(&r, tm, 0)) || (r = s, hm(&r, tm))) return 1;
+  if (!month(&s, tm)) return 0;
+  skip(&s);
+  if (!mday(&s, tm)) return 0;
+  skip(&s);
+  hms(&s, tm, 0);
+  return 1;
+}
+
+// LOCAL  --  mktime(tm), but for another time on the same day as the last
+//	      it goes by the offset mktime() gave then, once two calls at
+//	      either end of the day have shown it holds right through
+static time_t local(struct date_ctx *c, struct tm *tm)
+{
+  time_t w = civil_time(tm), day = w - ((w % 86400) + 86400) % 86400, t;
+  int isdst = tm->tm_isdst;
+  struct tm a, b;
+
+  if (c->known == 2 && day == c->day && isdst == c->isdst) return w - c->delta;
+  if (c->known == 1 && day == c->day && isdst == c->isdst) {
+    // Seen twice: see that the day has no change of offset, to go by it
+    time_t ta, tb;
+
+    civil_tm(day, &a);
+    a.tm_isdst = isdst, b = a;
+    b.tm_hour = 23, b.tm_min = b.tm_sec = 59;
+    ta = mktime(&a), tb = mktime(&b);
+    c->known = day - ta == c->delta && day + 86399 - tb == c->delta && localtime_r(&ta, &a) && localtime_r(&tb, &b)
+               && a.tm_gmtoff == b.tm_gmtoff && a.tm_isdst == b.tm_isdst ? 2 : 0;
+    if (c->known) return w - c->delta;
+  }
+  t = mktime(tm);
+  c->known = 1, c->day = day, c->isdst = isdst, c->delta = w - t;
+  return t;
+}
+
+/*
+ * ISO 8601 in words of eight bytes, the first of them in the low byte:
+ * "YYYY-MM-" from s, "DD" from s + 8 and "HH:MM:SS" from s + 11.
+ */
+#define ONES 0x0101010101010101ULL
+
+static uint64_t le64(const char *s)
+{
+  const unsigned char *p = (const unsigned char *)s;
+
+  return (uint64_t)p[0] | (uint64_t)p[1] << 8 | (uint64_t)p[2] << 16 | (uint64_t)p[3] << 24 |
+         (uint64_t)p[4] << 32 | (uint64_t)p[5] << 40 | (uint64_t)p[6] << 48 | (uint64_t)p[7] << 56;
+}
+
+// DIGITS  --  Whether the bytes of w in mask are all '0' to '9'
+static int digits(uint64_t w, uint64_t mask)
+{
+  // A carry out of a byte that isn't a digit only spoils the next one
+  return !((((w & 0xf0 * ONES) ^ 0x30 * ONES) | (((w + 0x06 * ONES) & 0xf0 * ONES) ^ 0x30 * ONES)) & mask);
+}
+
+// PAIRS  --  Byte i of the result is the number in the digits at i and i + 1
+static uint64_t pairs(uint64_t w)
+{
+  w &= 0x0f * ONES;
+  return w * 10 + (w >> 8);
+}
+
+static int digit(char c)
+{
+  return c >= '0' && c <= '9';
+}
+
+// ISO  --  The time at s, of length len and at least 19, if it is in ISO 8601
+static int iso(const char *s, size_t len, time_t *t, struct date_ctx *c)
+{
+  uint64_t a = le64(s), d = le64(s + 8), w = le64(s + 11);
+  struct tm tm = { 0 };
+  size_t i = 19;
+  int off = 0, y, m;
+
+  if (!digits(a, 0x00ffff00ffffffffULL) || (a & 0xff0000ff00000000ULL) != 0x2d00002d00000000ULL ||
+      !digits(d, 0xffff) || (s[10] != 'T' && s[10] != 't' && s[10] != ' ') ||
+      !digits(w, 0xffff00ffff00ffffULL) || (w & 0x0000ff0000ff0000ULL) != 0x00003a00003a0000ULL)
+    return 0;
+  a = pairs(a), d = pairs(d), w = pairs(w);
+  y = (a & 0xff) * 100 + (a >> 16 & 0xff), m = a >> 40 & 0xff;
+  tm.tm_year = y - 1900, tm.tm_mon = m - 1, tm.tm_mday = d & 0xff;
+  tm.tm_hour = w & 0xff, tm.tm_min = w >> 24 & 0xff, tm.tm_sec = w >> 48 & 0xff;
+  if (m < 1 || m > 12 || tm.tm_mday < 1 || tm.tm_mday > civil_mdays(y, m) ||
+      tm.tm_hour > 23 || tm.tm_min > 59 || tm.tm_sec > 60)
+    return 0;
+
+  // Fractions of a second go, and then the zone
+  if (i < len && s[i] == '.') {
+    if (++i == len || !digit(s[i])) return 0;
+    while (i < len && digit(s[i])) i++;
+  }
+  if (i < len && (s[i] == 'Z' || s[i] == 'z')) {
+    *t = civil_time(&tm);
+    return 1;
+  }
+  if (i < len && (s[i] == '+' || s[i] == '-')) {
+    // +hh:mm or +hhmm, a byte at a time so as to stop at a NUL
+    const char *z = s + i + 1;
+    size_t n = len - i - 1, colon;
+    int hh, mm;
+
+    if (n < 2 || !digit(z[0]) || !digit(z[1])) return 0;
+    colon = n > 2 && z[2] == ':';
+    if (n < 4 + colon || !digit(z[2 + colon]) || !digit(z[3 + colon])) return 0;
+    hh = (z[0] - '0') * 10 + z[1] - '0', mm = (z[2 + colon] - '0') * 10 + z[3 + colon] - '0';
+    if (hh > 23 || mm > 59) return 0;
+    off = hh * 3600 + mm * 60;
+    *t = civil_time(&tm) - (s[i] == '+' ? off : -off);
+    return 1;
+  }
+  tm.tm_isdst = -1;
+  *t = local(c, &tm);
+  return 1;
+}
+
+// DATE_PARSE_BATCH  --  Parse n dates that needn't end in a NUL, the ISO
+//			 8601 ones without copying them; marks in bad (if
+//			 not NULL) those it can't and returns how many
+size_t date_parse_batch(const struct date_slice *d, size_t n, time_t *t, char *bad, struct date_ctx *c)
+{
+  char buf[256];
+  size_t nbad = 0;
+  int ok;
+
+  for (size_t i = 0; i < n; i++) {
+    if (!(ok = d[i].len >= 19 && iso(d[i].s, d[i].len, &t[i], c))) {
+      size_t len = d[i].len < sizeof(buf) ? d[i].len : sizeof(buf) - 1;
+
+      memcpy(buf, d[i].s, len);
+      buf[len] = 0;
+      ok = !date_parse_ctx(buf, &t[i], c);
+    }
+    if (bad) bad[i] = !ok;
+    nbad += !ok;
+  }
+  return nbad;
+}
+
+// DATE_CTX_INIT  --  Read the time zone for date_parse_ctx()
+void date_ctx_init(struct date_ctx *c)
+{
   extern long timezone;
+
   tzset();
+  c->timezone = timezone;
+  c->known = 0;
+}
+
+// The time zone date_parse_r() goes by, read the first time it is called
+static struct date_ctx zone;
+static pthread_once_t zoneonce = PTHREAD_ONCE_INIT;
 
-  int indx = 0;
-  static struct tm tm; // static = bss = zeroed
+static void zoneinit(void)
+{
+  date_ctx_init(&zone);
+}
+
+// Returns 0 and stores the time in *t, or -1 with errno set to EINVAL if
+// str is in none of the formats. The time zone is read once, on the first
+// call; only the day mktime() was last asked about is kept per call.
+int date_parse_r(const char *str, time_t *t)
+{
+  struct date_ctx c;
+
+  if (*str == '@') {
+    *t = atol(str + 1);
+    return 0;
+  }
+  pthread_once(&zoneonce, zoneinit);
+  c = zone;
+  return date_parse_ctx(str, t, &c);
+}
+
+// As date_parse_r(), but with the time zone in c
+int date_parse_ctx(const char *str, time_t *t, struct date_ctx *c)
+{
+  if (*str == '@') {
+    *t = atol(str + 1);
+    return 0;
+  }
+
+  if (strnlen(str, 19) == 19 && str[4] == '-' && iso(str, SIZE_MAX, t, c))
+    return 0;
+
+  struct tm tm = {0};
   if ((*str == '+' || *str == '-') && (str[1] != '+' && str[1] != '-')) {
     // Default initilization for gmtime at unix epoch
     tm.tm_year = 70;
@@ -52,34 +411,34 @@ time_t date_parse(char *str)
     tm.tm_wday = 4;
     tm.tm_zone = "UTC"; // GMT on glibc, UTC on musl
 
-    if (!strptime(str + 1, "%T", &tm) &&
-        !strptime(str + 1, "%H:%M", &tm) &&
-        (!strptime(str + 1, "%dd %H:%M", &tm) || !(++tm.tm_mday)))
-      dprintf(2, "Unknown date format: `%s`\n", str), exit(2);
+    // %T, %H:%M or %dd %H:%M
+    const char *s = str + 1;
+    if (!hms(&s, &tm, 0) && (s = str + 1, !hm(&s, &tm)) &&
+        (s = str + 1, !mday(&s, &tm) || *s++ != 'd' || !hm(&s, &tm) || !(++tm.tm_mday)))
+      return errno = EINVAL, -1;
 
     time_t now = time(0);
-    now += (*str == '+') ? mktime(&tm) : -mktime(&tm);
+    now += (*str == '+') ? local(c, &tm) : -local(c, &tm);
 
-    return now - timezone;
+    *t = now - c->timezone;
+    return 0;
   }
 
-  while (!strptime(str, formats[indx], &tm) && formats[++indx]) ;
-
   // ABANDON ALL HOPE; YE WHO ENTER HERE
   // Initiliaze tm after this so we don't show stuff for the year 1900.
 
-  if (!formats[indx]) {
+  if (!date(str, &tm)) {
     time_t now = time(0);
-    tm = *localtime(&now);
-    indx = tm.tm_hour = tm.tm_min = tm.tm_sec = 0;
+    localtime_r(&now, &tm);
+    tm.tm_hour = tm.tm_min = tm.tm_sec = 0;
 
-    while (!strptime(str, ifmts[indx], &tm))
-      if (!ifmts[++indx])
-        dprintf(2, "Unknown date format: `%s`\n", str), exit(2);
+    if (!today(str, &tm))
+      return errno = EINVAL, -1;
 
-    return mktime(&tm);
+    *t = local(c, &tm);
+    return 0;
   }
 
-  // printf("%s", asctime(&tm));
-  return mktime(&tm) - timezone;
+  *t = local(c, &tm) - c->timezone;
+  return 0;
 }
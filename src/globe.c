@@ -26,9 +26,10 @@
 */
 
 #include <stdio.h>
+#include <stdlib.h>
 #include <time.h>
-extern int atoi(char *nptr);
-extern int abs(int);
+
+#include "date_arg.h"
 
 static char *globes[30] = {
 "             ._o##HMP'\"\"\"&&Z##o_\n"
@@ -752,13 +753,10 @@ static char *globes[30] = {
 "              \"-~-\\o#######M##\"\"'"
 };
 
-
-extern time_t date_parse(char *str);
-
 int main(int argc, char **argv)
 {
   setvbuf(stdout, 0, _IOFBF, 0);
-  time_t now = (argc > 1) ? date_parse(argv[1]) : time(0);
+  time_t now = (argc > 1) ? date_arg(argv[1]) : time(0);
 #define OFFSET 43200
   int indx = (now + OFFSET) % 86400 / (86400 / 30);
   puts(globes[abs(indx)]);
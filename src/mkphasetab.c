@@ -0,0 +1,59 @@
+/* mkphasetab - precompute the quarter phases of the moon for phasetab
+** See LICENSE
+*/
+
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "moon.h"
+#include "phasetab.h"
+
+#define HELPTXT "mkphasetab [-h] [-c] [-s YEAR] [-e YEAR] FILE\n"
+char *help = HELPTXT
+"-c write C source to build into the programs instead of a table file\n"
+"-s first year covered (default 1900)\n"
+"-e last year covered (default 2200)";
+
+int main(int argc, char **argv)
+{
+  int csrc = 0, y0 = 1900, y1 = 2200;
+
+  for (int i = 0; (i = getopt(argc, argv, "hcs:e:")) != -1; ) switch (i) {
+    case 'h': puts(help); exit(1);
+    case 'c': csrc = 1; break;
+    case 's': y0 = atoi(optarg); break;
+    case 'e': y1 = atoi(optarg); break;
+    default: puts("Error: Unknown Option\n"HELPTXT); exit(1);
+    }
+  if (optind != argc - 1 || y1 < y0) puts("Error: Bad arguments\n"HELPTXT), exit(1);
+
+  /* One lunation of margin either side of the years asked for */
+  double k0 = floor((y0 - 1900) * 12.3685) - 1, k1 = ceil((y1 + 1 - 1900) * 12.3685) + 1;
+  struct phasetab_hdr h = { PHASETAB_MAGIC, PHASETAB_VERSION, 4 * (k1 - k0), k0 };
+  double ev[4];
+  FILE *f = fopen(argv[optind], "w");
+
+  if (!f) perror(argv[optind]), exit(2);
+  if (csrc) {
+    fprintf(f, "/* Generated by mkphasetab -s %d -e %d */\n\n#include <stddef.h>\n\n", y0, y1);
+    fprintf(f, "const double phasetab_embedded_k0 = %.1f;\n", k0);
+    fprintf(f, "const size_t phasetab_embedded_count = %u;\n", (unsigned)h.count);
+    fprintf(f, "const double phasetab_embedded[] = {\n");
+  } else
+    fwrite(&h, sizeof(h), 1, f);
+
+  for (double k = k0; k < k1; k++) {
+    truephase_all(k, ev);
+    if (csrc)
+      fprintf(f, "  %.17g, %.17g, %.17g, %.17g,\n", ev[0], ev[1], ev[2], ev[3]);
+    else
+      fwrite(ev, sizeof(*ev), 4, f);
+  }
+
+  if (csrc)
+    fprintf(f, "};\n");
+  if (fclose(f)) perror(argv[optind]), exit(2);
+}
@@ -0,0 +1,155 @@
+/* moon - libmoon, the phase of the moon after moontool
+** See LICENSE
+**
+** Everything here may be called from several threads at once, except
+** astro_set_tier() and astro_set_isa(), which change the setting for the
+** whole process and belong before any other threads start.  Nothing exits
+** or aborts; failures are returned.
+*/
+
+#ifndef MOON_H
+#define MOON_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <time.h>
+
+/*
+ * Accuracy tiers, worst case against ASTRO_EXACT over 1800-2200:
+ *
+ *		illuminated fraction	age		quarter phase times
+ * ASTRO_FAST	1e-9			1e-8 days	1e-8 days (1 ms)
+ * ASTRO_APPROX	1e-5			1e-4 days	1e-4 days (9 s)
+ *
+ * ASTRO_APPROX takes its sines and cosines in single precision, but
+ * reduces angles and sums the terms in double: the Moon's mean longitude
+ * runs to a million degrees over these years, which a float holds only to
+ * 0.06 degrees, putting the illuminated fraction out by 5e-4.  On x86-64,
+ * where double costs little more than float, it is no faster than
+ * ASTRO_FAST; it is for FPUs that are slow in double.  phase_batch()
+ * follows the tier with a vectorized kernel for each, and below
+ * ASTRO_EXACT gives just what phase() does.
+ */
+enum astro_tier { ASTRO_EXACT, ASTRO_FAST, ASTRO_APPROX };
+
+/* The phase of the moon, with the positions of the Sun and Moon */
+struct moon_ephem {
+  double phase; /* Terminator phase, 0 to 1 from new moon */
+  double illum; /* Illuminated fraction of the disc */
+  double age; /* Days since new moon */
+  double moondist; /* Moon's distance from the centre of the Earth, km */
+  double moonang; /* Moon's angular diameter, degrees */
+  double sundist; /* Sun's distance, km */
+  double sunang; /* Sun's angular diameter, degrees */
+};
+
+/*
+ * A phase cursor remembers the quarter phases around the last date it was
+ * moved to: ev[0] to ev[3] are the new moon, first quarter, full moon and
+ * last quarter of lunation k, ev[4] is the next new moon, and the date is
+ * between ev[which] and ev[which + 1].  Seek it once before advancing it.
+ */
+struct phase_cursor {
+  double k;
+  double ev[5];
+  int which;
+};
+
+/* Everything there is to say about the moon at one time */
+struct moon_state {
+  int64_t time; /* Unix time */
+  double jd; /* Its Julian date, from moon_jd() */
+  struct moon_ephem e;
+  int32_t index; /* phaseindex() */
+  int32_t which; /* Quarter phase at prev, 0 (new moon) to 3 */
+  int64_t lunation;
+  double prev, next; /* Julian dates of the quarter phases either side */
+};
+
+/*
+ * A moon_state published in shared memory.  The publisher makes seq odd
+ * while it writes state and even again after; a reader copies state and
+ * keeps the copy if seq was the same even number before and after.
+ */
+#define MOONSHM_NAME "/moon"
+#define MOONSHM_MAGIC 0x4e4f4f4d /* "MOON" */
+#define MOONSHM_VERSION 1
+
+struct moon_shm {
+  uint32_t magic, version;
+  uint32_t seq;
+  int32_t interval; /* Seconds between updates, set once */
+  struct moon_state state;
+};
+
+void astro_set_tier(enum astro_tier t);
+int astro_set_isa(const char *name);
+const char *astro_isa(void);
+void ephemeris(double pdate, struct moon_ephem *e);
+double phase(double pdate, double *pphase, double *mage);
+int phaseindex(double ilumfrac, double mage);
+void phase_batch(const double *jd, size_t n, double *frac, double *illum, double *age);
+long lunation(double jd);
+void truephase_all(double k, double out[4]);
+void phasehunt2(double sdate, double phases[2], int *which);
+void phase_cursor_seek(struct phase_cursor *pc, double sdate);
+void phase_cursor_advance(struct phase_cursor *pc, double sdate);
+
+/*
+ * The time zone as date_ctx_init() found it, for parsing many dates: one
+ * context a thread, and TZ changed later isn't seen.  It also remembers
+ * the offset from local time through the last day parsed.
+ */
+struct date_ctx {
+  long timezone; /* Seconds west of UTC, from tzset() */
+  time_t day, delta; /* Local times on day (as if UTC) are UTC + delta */
+  int isdst; /* The tm_isdst delta is for */
+  int known; /* 0 none, 1 seen on one time, 2 checked through the day */
+};
+
+/* A string that needn't end in a NUL */
+struct date_slice {
+  const char *s;
+  size_t len;
+};
+
+int date_parse_r(const char *str, time_t *t);
+void date_ctx_init(struct date_ctx *c);
+int date_parse_ctx(const char *str, time_t *t, struct date_ctx *c);
+size_t date_parse_batch(const struct date_slice *d, size_t n, time_t *t, char *bad, struct date_ctx *c);
+
+/*
+ * UTC dates in the proleptic Gregorian calendar, in integers for any
+ * int64_t time, with no time zone: months 1 to 12, days from 1970-01-01.
+ */
+int64_t civil_day(int64_t t, int32_t *sec);
+int64_t civil_days(int64_t y, int m, int d);
+void civil_from_days(int64_t z, int64_t *y, int *m, int *d);
+int civil_mdays(int64_t y, int m);
+int64_t civil_time(const struct tm *tm);
+struct tm *civil_tm(int64_t t, struct tm *tm);
+double civil_jd(int64_t t);
+
+double moon_jd(time_t t);
+int moon_format(FILE *out, const char *fmt, time_t t, const struct moon_ephem *e);
+int moon_format_state(FILE *out, const char *fmt, const struct moon_state *s);
+void moon_render(FILE *out, time_t t);
+
+/* An mprintf format compiled once, to print for many times */
+struct moon_fmt;
+struct moon_fmt *moon_fmt_compile(const char *fmt, int *unknown);
+size_t moon_fmt_run(const struct moon_fmt *p, time_t t, char *buf, size_t size);
+size_t moon_fmt_range(const struct moon_fmt *p, time_t t, long step, size_t n, char *buf, size_t size, size_t *done);
+time_t moon_fmt_next(const struct moon_fmt *p, time_t t);
+void moon_fmt_free(struct moon_fmt *p);
+
+int moon_state(time_t t, struct moon_state *s);
+struct moon_shm *moonshm_open(const char *name, int interval);
+void moonshm_close(struct moon_shm *m);
+void moonshm_publish(struct moon_shm *m, const struct moon_state *s);
+int moonshm_read(const struct moon_shm *m, struct moon_state *s);
+
+int moond_query(const char *path, const char *req, char **ans, size_t *len);
+
+#endif
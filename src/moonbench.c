@@ -0,0 +1,953 @@
+/* moonbench - throughput and agreement checks for the astro kernels
+** See LICENSE
+*/
+
+#include <math.h>
+#include <pthread.h>
+#include <sched.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "moon.h"
+#include "bucket.h"
+#include "cheb.h"
+#include "par.h"
+#include "phasetab.h"
+
+#define HELPTXT "moonbench [-h] [-c] [-n COUNT] [TEST...]\n"
+char *help = HELPTXT
+"-c check results against the scalar code instead of timing\n"
+"-n number of dates per test (default 1000000)\n"
+"tests: batch cheb truephase phasetab cursor bucket tiers isa shm next format range scale date civil";
+
+#define synmonth 29.53058868
+
+static size_t count = 1000000;
+static int check;
+
+static double now(void)
+{
+  struct timespec ts;
+
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+// DATES --  Pseudo-random Julian dates between 1800 and 2200
+static double *dates(size_t n)
+{
+  double *jd = malloc(n * sizeof(*jd));
+  unsigned long x = 88172645463325252UL;
+
+  if (!jd) perror("moonbench"), exit(2);
+  for (size_t i = 0; i < n; i++) {
+    x ^= x << 13, x ^= x >> 7, x ^= x << 17;
+    jd[i] = 2378496.5 + (x >> 11) * (146097.0 / 9007199254740992.0);
+  }
+  return jd;
+}
+
+// RANGE --  Pseudo-random Julian dates in [jd0, jd1)
+static double *range(size_t n, double jd0, double jd1)
+{
+  double *jd = dates(n);
+
+  for (size_t i = 0; i < n; i++)
+    jd[i] = jd0 + (jd[i] - 2378496.5) * ((jd1 - jd0) / 146097.0);
+  return jd;
+}
+
+// REPORT --  Print one timing line, or compare an error with its tolerance
+static int report(char *name, char *what, double value, double tol)
+{
+  if (!check) return printf("%-8s %-24s %8.2f Mdates/s\n", name, what, value), 0;
+  if (value <= tol) return 0;
+  printf("%s: %s %g exceeds %g\n", name, what, value, tol);
+  return 1;
+}
+
+static int bench_batch(void)
+{
+  double *jd = dates(count), *fr = malloc(3 * count * sizeof(double));
+  double *il = fr + count, *ag = il + count, t, sink = 0;
+  int fail = 0;
+
+  if (!fr) perror("moonbench"), exit(2);
+  if (check) {
+    double efr = 0, eil = 0, eag = 0, f, i, a, d;
+
+    phase_batch(jd, count, fr, il, ag);
+    for (size_t n = 0; n < count; n++) {
+      f = phase(jd[n], &i, &a);
+      d = fabs(f - fr[n]);
+      efr = fmax(efr, fmin(d, 1 - d));
+      eil = fmax(eil, fabs(i - il[n]));
+      d = fabs(a - ag[n]);
+      eag = fmax(eag, fmin(d, synmonth - d));
+    }
+    fail |= report("batch", "phase error", efr, 1e-12);
+    fail |= report("batch", "illumination error", eil, 1e-12);
+    fail |= report("batch", "age error (days)", eag, 1e-10);
+  } else {
+    t = now();
+    for (size_t n = 0; n < count; n++)
+      sink += phase(jd[n], &il[n], &ag[n]);
+    report("batch", "phase()", count / (now() - t) / 1e6, 0);
+    t = now();
+    phase_batch(jd, count, fr, il, ag);
+    report("batch", "phase_batch()", count / (now() - t) / 1e6, 0);
+    if (sink < 0) puts("");
+  }
+  free(jd), free(fr);
+  return fail;
+}
+
+static int bench_cheb(void)
+{
+  double jd0 = 2415020.5, jd1 = 2488069.5; /* 1900 to 2100 */
+  double *jd = range(count, jd0, jd1), t, sink = 0, f, i, a, cf, ci, ca;
+  double efr = 0, eil = 0, eag = 0;
+  struct cheb_ephem ce;
+  int fail = 0;
+
+  t = now();
+  if (cheb_build(&ce, jd0, jd1, CHEB_SEGLEN)) perror("moonbench"), exit(2);
+  if (!check)
+    printf("%-8s %-24s %8.2f s\n", "cheb", "fit 1900-2100", now() - t);
+
+  for (size_t n = 0; n < count; n++) {
+    double d;
+
+    f = phase(jd[n], &i, &a);
+    cf = cheb_phase(&ce, jd[n], &ci, &ca);
+    d = fabs(f - cf);
+    efr = fmax(efr, fmin(d, 1 - d));
+    eil = fmax(eil, fabs(i - ci));
+    d = fabs(a - ca);
+    eag = fmax(eag, fmin(d, synmonth - d));
+  }
+
+  if (check) {
+    fail |= report("cheb", "phase error", efr, 1e-9);
+    fail |= report("cheb", "illumination error", eil, 1e-9);
+    fail |= report("cheb", "age error (days)", eag, 1e-8);
+    /* Outside the fitted range it falls back to phase() */
+    f = phase(jd1 + 100, &i, &a);
+    cf = cheb_phase(&ce, jd1 + 100, &ci, &ca);
+    fail |= report("cheb", "fallback mismatch", (f != cf) + (i != ci) + (a != ca), 0);
+  } else {
+    printf("%-8s max error: phase %.3g, illumination %.3g, age %.3g days\n",
+        "cheb", efr, eil, eag);
+    t = now();
+    for (size_t n = 0; n < count; n++)
+      sink += phase(jd[n], &i, &a);
+    report("cheb", "phase()", count / (now() - t) / 1e6, 0);
+    t = now();
+    for (size_t n = 0; n < count; n++)
+      sink += cheb_phase(&ce, jd[n], &i, &a);
+    report("cheb", "cheb_phase()", count / (now() - t) / 1e6, 0);
+    if (sink < 0) puts("");
+  }
+  cheb_free(&ce);
+  free(jd);
+  return fail;
+}
+
+#define dsin(x) (sin((x) * (M_PI / 180.0)))
+#define dcos(x) (cos((x) * (M_PI / 180.0)))
+
+// REF_TRUEPHASE --  truephase() as it was in moontool, one sine per term
+static double ref_truephase(double k, double pha)
+{
+  double t, t2, t3, pt, m, mprime, f;
+
+  k += pha;
+  t = k / 1236.85;
+  t2 = t * t;
+  t3 = t2 * t;
+  pt = 2415020.75933 + synmonth * k + 0.0001178 * t2 - 0.000000155 * t3
+      + 0.00033 * dsin(166.56 + 132.87 * t - 0.009173 * t2);
+  m = 359.2242 + 29.10535608 * k - 0.0000333 * t2 - 0.00000347 * t3;
+  mprime = 306.0253 + 385.81691806 * k + 0.0107306 * t2 + 0.00001236 * t3;
+  f = 21.2964 + 390.67050646 * k - 0.0016528 * t2 - 0.00000239 * t3;
+  if (pha < 0.01 || fabs(pha - 0.5) < 0.01)
+    return pt + (0.1734 - 0.000393 * t) * dsin(m) + 0.0021 * dsin(2 * m)
+        - 0.4068 * dsin(mprime) + 0.0161 * dsin(2 * mprime)
+        - 0.0004 * dsin(3 * mprime) + 0.0104 * dsin(2 * f)
+        - 0.0051 * dsin(m + mprime) - 0.0074 * dsin(m - mprime)
+        + 0.0004 * dsin(2 * f + m) - 0.0004 * dsin(2 * f - m)
+        - 0.0006 * dsin(2 * f + mprime) + 0.0010 * dsin(2 * f - mprime)
+        + 0.0005 * dsin(m + 2 * mprime);
+  pt += (0.1721 - 0.0004 * t) * dsin(m) + 0.0021 * dsin(2 * m)
+      - 0.6280 * dsin(mprime) + 0.0089 * dsin(2 * mprime)
+      - 0.0004 * dsin(3 * mprime) + 0.0079 * dsin(2 * f)
+      - 0.0119 * dsin(m + mprime) - 0.0047 * dsin(m - mprime)
+      + 0.0003 * dsin(2 * f + m) - 0.0004 * dsin(2 * f - m)
+      - 0.0006 * dsin(2 * f + mprime) + 0.0021 * dsin(2 * f - mprime)
+      + 0.0003 * dsin(m + 2 * mprime) + 0.0004 * dsin(m - 2 * mprime)
+      - 0.0003 * dsin(2 * m + mprime);
+  if (pha < 0.5)
+    return pt + 0.0028 - 0.0004 * dcos(m) + 0.0003 * dcos(mprime);
+  return pt - 0.0028 + 0.0004 * dcos(m) - 0.0003 * dcos(mprime);
+}
+
+static int bench_truephase(void)
+{
+  double *jd = dates(count), out[4], err = 0, t, sink = 0, ph[2];
+  size_t nk = count / 4 + 1;
+  int which;
+
+  /* Lunations from 1800 to 2200 and beyond */
+  for (size_t n = 0; n < nk; n++) {
+    double k = -1237 + (double)(n % 6200);
+
+    truephase_all(k, out);
+    for (int q = 0; q < 4; q++)
+      err = fmax(err, fabs(out[q] - ref_truephase(k, q * 0.25)));
+  }
+  if (check) {
+    free(jd);
+    return report("truephase", "error (days)", err, 1e-8);
+  }
+  printf("%-9s max error: %.3g days\n", "truephase", err);
+  t = now();
+  for (size_t n = 0; n < nk; n++)
+    for (int q = 0; q < 4; q++)
+      sink += ref_truephase(n % 6200, q * 0.25);
+  report("truephase", "one sine per term", nk / (now() - t) / 1e6, 0);
+  t = now();
+  for (size_t n = 0; n < nk; n++)
+    truephase_all(n % 6200, out), sink += out[0];
+  report("truephase", "truephase_all()", nk / (now() - t) / 1e6, 0);
+  t = now();
+  for (size_t n = 0; n < count; n++)
+    phasehunt2(jd[n], ph, &which), sink += ph[0];
+  report("truephase", "phasehunt2()", count / (now() - t) / 1e6, 0);
+  if (sink < 0) puts("");
+  free(jd);
+  return 0;
+}
+
+static int bench_phasetab(void)
+{
+  double jd0 = 2415020.5, jd1 = 2488069.5; /* 1900 to 2100 */
+  double *jd = range(count, jd0, jd1), *ev, p1[2], p2[2], t, sink = 0;
+  struct phasetab pt = { -2, 0, NULL, NULL, 0 };
+  size_t bad = 0, differ = 0;
+  int w1, w2;
+
+  pt.count = 4 * 2480;
+  if (!(ev = malloc(pt.count * sizeof(*ev)))) perror("moonbench"), exit(2);
+  for (size_t k = 0; k < pt.count / 4; k++)
+    truephase_all(pt.k0 + k, ev + 4 * k);
+  pt.ev = ev;
+
+  for (size_t n = 0; n < count; n++) {
+    phasehunt2(jd[n], p1, &w1);
+    if (phasetab_hunt(&pt, jd[n], p2, &w2) || !(p2[0] <= jd[n] && jd[n] < p2[1]))
+      bad++;
+    else
+      differ += (p1[0] != p2[0]) + (p1[1] != p2[1]) + (w1 != w2);
+  }
+  if (check) {
+    free(jd), free(ev);
+    return report("phasetab", "mismatches", bad + differ, 0);
+  }
+  t = now();
+  for (size_t n = 0; n < count; n++)
+    phasehunt2(jd[n], p1, &w1), sink += p1[0];
+  report("phasetab", "phasehunt2()", count / (now() - t) / 1e6, 0);
+  t = now();
+  for (size_t n = 0; n < count; n++)
+    phasetab_hunt(&pt, jd[n], p1, &w1), sink += p1[0];
+  report("phasetab", "phasetab_hunt()", count / (now() - t) / 1e6, 0);
+  if (sink < 0) puts("");
+  free(jd), free(ev);
+  return 0;
+}
+
+static int cmpdouble(const void *a, const void *b)
+{
+  return (*(double *)a > *(double *)b) - (*(double *)a < *(double *)b);
+}
+
+static int bench_cursor(void)
+{
+  double *jd = range(count, 2415020.5, 2488069.5), ph[2], t, sink = 0;
+  struct phase_cursor pc;
+  size_t differ = 0;
+  int which;
+
+  /* Timestamps a few minutes apart, with the odd step backwards */
+  qsort(jd, count, sizeof(*jd), cmpdouble);
+  for (size_t n = 7; n < count; n += 97)
+    jd[n] = jd[n - 7];
+
+  phase_cursor_seek(&pc, jd[0]);
+  for (size_t n = 0; n < count; n++) {
+    phase_cursor_advance(&pc, jd[n]);
+    phasehunt2(jd[n], ph, &which);
+    differ += (ph[0] != pc.ev[pc.which]) + (ph[1] != pc.ev[pc.which + 1]) + (which != pc.which);
+  }
+  if (check) {
+    free(jd);
+    return report("cursor", "mismatches", differ, 0);
+  }
+  t = now();
+  for (size_t n = 0; n < count; n++)
+    phasehunt2(jd[n], ph, &which), sink += ph[0];
+  report("cursor", "phasehunt2()", count / (now() - t) / 1e6, 0);
+  t = now();
+  phase_cursor_seek(&pc, jd[0]);
+  for (size_t n = 0; n < count; n++)
+    phase_cursor_advance(&pc, jd[n]), sink += pc.ev[pc.which];
+  report("cursor", "phase_cursor_advance()", count / (now() - t) / 1e6, 0);
+  if (sink < 0) puts("");
+  free(jd);
+  return 0;
+}
+
+static int index_at(double jd)
+{
+  double i, a;
+
+  phase(jd, &i, &a);
+  return phaseindex(i, a);
+}
+
+static int bench_bucket(void)
+{
+  double jd0 = 2415020.5, jd1 = 2488069.5; /* 1900 to 2100 */
+  double *jd = range(count, jd0, jd1), t;
+  unsigned char *out = malloc(count);
+  struct bucket_table bt;
+  size_t differ = 0, sink = 0;
+
+  if (!out) perror("moonbench"), exit(2);
+  t = now();
+  if (bucket_build(&bt, jd0, jd1)) perror("moonbench"), exit(2);
+  if (!check)
+    printf("%-8s %-24s %8.2f s, %zu segments\n", "bucket", "solve 1900-2100", now() - t, bt.n);
+
+  if (check) {
+    /* Exact on both sides of every boundary */
+    for (size_t s = 1; s < bt.n; s++)
+      differ += (index_at(bt.start[s]) != bt.idx[s])
+          + (index_at(nextafter(bt.start[s], 0)) != bt.idx[s - 1]);
+    for (size_t n = 0; n < count; n++)
+      differ += bucket_index(&bt, jd[n]) != index_at(jd[n]);
+    qsort(jd, count, sizeof(*jd), cmpdouble);
+    bucket_classify(&bt, jd, count, out);
+    for (size_t n = 0; n < count; n++)
+      differ += out[n] != index_at(jd[n]);
+    bucket_free(&bt), free(jd), free(out);
+    return report("bucket", "mismatches", differ, 0);
+  }
+  t = now();
+  for (size_t n = 0; n < count; n++)
+    sink += index_at(jd[n]);
+  report("bucket", "phaseindex(phase())", count / (now() - t) / 1e6, 0);
+  t = now();
+  for (size_t n = 0; n < count; n++)
+    sink += bucket_index(&bt, jd[n]);
+  report("bucket", "bucket_index()", count / (now() - t) / 1e6, 0);
+  qsort(jd, count, sizeof(*jd), cmpdouble);
+  t = now();
+  bucket_classify(&bt, jd, count, out);
+  report("bucket", "bucket_classify() sorted", count / (now() - t) / 1e6, 0);
+  if (sink + out[0] == 1) puts("");
+  bucket_free(&bt), free(jd), free(out);
+  return 0;
+}
+
+static int bench_tiers(void)
+{
+  static struct {
+    char *name;
+    enum astro_tier tier;
+    double eil, eag, eev; /* Tolerances, as documented in moon.h */
+  } tiers[] = {
+    { "exact", ASTRO_EXACT, 0, 0, 0 },
+    { "fast", ASTRO_FAST, 1e-9, 1e-8, 1e-8 },
+    { "approx", ASTRO_APPROX, 1e-5, 1e-4, 1e-4 },
+  };
+  double *jd = dates(count), *il = malloc(5 * count * sizeof(double)), *ag = il + count;
+  double *bf = ag + count, *bi = bf + count, *ba = bi + count;
+  size_t nk = count / 16 + 1, differ;
+  double *ev = malloc(4 * nk * sizeof(double)), out[4], t, i, a, sink = 0;
+  int fail = 0;
+
+  if (!il || !ev) perror("moonbench"), exit(2);
+  astro_set_tier(ASTRO_EXACT);
+  for (size_t n = 0; n < count; n++)
+    phase(jd[n], &il[n], &ag[n]);
+  for (size_t k = 0; k < nk; k++)
+    truephase_all(-1237 + (double)(k % 6200), ev + 4 * k);
+
+  for (size_t r = 0; r < sizeof(tiers) / sizeof(*tiers); r++) {
+    double eil = 0, eag = 0, eev = 0, d, tp, tt;
+
+    astro_set_tier(tiers[r].tier);
+    for (size_t n = 0; n < count; n++) {
+      phase(jd[n], &i, &a);
+      eil = fmax(eil, fabs(i - il[n]));
+      d = fabs(a - ag[n]);
+      eag = fmax(eag, fmin(d, synmonth - d));
+    }
+    for (size_t k = 0; k < nk; k++) {
+      truephase_all(-1237 + (double)(k % 6200), out);
+      for (int q = 0; q < 4; q++)
+        eev = fmax(eev, fabs(out[q] - ev[4 * k + q]));
+    }
+    if (check) {
+      // phase_batch() follows the tier, and away from ASTRO_EXACT is phase()
+      phase_batch(jd, count, bf, bi, ba);
+      differ = 0;
+      for (size_t n = 0; tiers[r].tier != ASTRO_EXACT && n < count; n++)
+        differ += phase(jd[n], &i, &a) != bf[n] || i != bi[n] || a != ba[n];
+      fail |= report(tiers[r].name, "phase_batch() differing", differ, 0);
+      fail |= report(tiers[r].name, "illumination error", eil, tiers[r].eil);
+      fail |= report(tiers[r].name, "age error (days)", eag, tiers[r].eag);
+      fail |= report(tiers[r].name, "event time error (days)", eev, tiers[r].eev);
+      continue;
+    }
+    t = now();
+    for (size_t n = 0; n < count; n++)
+      sink += phase(jd[n], &i, &a);
+    tp = now() - t;
+    t = now();
+    for (size_t k = 0; k < nk; k++)
+      truephase_all(k % 6200, out), sink += out[0];
+    tt = now() - t;
+    printf("%-8s phase() %6.2f Mdates/s, truephase_all() %6.2f M/s, max error:"
+        " illumination %.2g, age %.2g days, events %.2g days\n", tiers[r].name,
+        count / tp / 1e6, nk / tt / 1e6, eil, eag, eev);
+  }
+  astro_set_tier(ASTRO_EXACT);
+  if (sink < 0) puts("");
+  free(jd), free(il), free(ev);
+  return fail;
+}
+
+/* Differences between instruction set variants; 0 unless FMA is contracted */
+#define ISA_TOL 1e-12
+
+static int bench_isa(void)
+{
+  static const char *isas[] = { "baseline", "avx2", "avx512" };
+  static const enum astro_tier tiers[] = { ASTRO_EXACT, ASTRO_FAST, ASTRO_APPROX };
+  size_t nk = count / 16 + 1, nr = count + 4 * nk + 2 * nk + 3 * count;
+  double *jd = dates(count), *ref = malloc(3 * nr * sizeof(double)), *res = malloc(nr * sizeof(double));
+  double t, sink = 0;
+  int fail = 0;
+
+  if (!ref || !res) perror("moonbench"), exit(2);
+  for (size_t r = 0; r < sizeof(isas) / sizeof(*isas); r++) {
+    char name[32];
+    double tp, tt, tb;
+
+    if (astro_set_isa(isas[r])) {
+      if (!check) printf("%-8s not available\n", isas[r]);
+      continue;
+    }
+    for (size_t v = 0; v < sizeof(tiers) / sizeof(*tiers); v++) {
+      double *o = r ? res : ref + v * nr, err = 0, a;
+      int which;
+
+      astro_set_tier(tiers[v]);
+      for (size_t n = 0; n < count; n++)
+        *o++ = phase(jd[n], &a, &a) + a;
+      for (size_t k = 0; k < nk; k++, o += 4)
+        truephase_all(-1237 + (double)(k % 6200), o);
+      for (size_t k = 0; k < nk; k++, o += 2) {
+        phasehunt2(jd[k], o, &which);
+        o[0] += which;
+      }
+      phase_batch(jd, count, o, o + count, o + 2 * count);
+      for (size_t n = 0; r && n < nr; n++)
+        err = fmax(err, fabs(res[n] - ref[v * nr + n]));
+      if (check) {
+        snprintf(name, sizeof(name), "%s/%d", isas[r], tiers[v]);
+        fail |= report(name, "difference from baseline", err, ISA_TOL);
+      }
+    }
+    astro_set_tier(ASTRO_EXACT);
+    if (check)
+      continue;
+    t = now();
+    for (size_t n = 0; n < count; n++)
+      sink += phase(jd[n], res, res + 1);
+    tp = now() - t;
+    t = now();
+    for (size_t k = 0; k < nk; k++)
+      truephase_all(k % 6200, res), sink += res[0];
+    tt = now() - t;
+    t = now();
+    phase_batch(jd, count, res, res + count, res + 2 * count);
+    tb = now() - t;
+    printf("%-8s phase() %6.2f Mdates/s, truephase_all() %6.2f M/s, phase_batch() %6.2f Mdates/s\n",
+        isas[r], count / tp / 1e6, nk / tt / 1e6, count / tb / 1e6);
+  }
+  astro_set_isa(NULL);
+  if (sink < 0) puts("");
+  free(jd), free(ref), free(res);
+  return fail;
+}
+
+static volatile int shmstop;
+
+/* Publish states whose every field is the same count */
+static void *shmwriter(void *arg)
+{
+  struct moon_shm *m = arg;
+  struct moon_state st;
+
+  for (long k = 1; !shmstop; k++) {
+    st.time = st.lunation = st.index = st.which = k;
+    st.jd = st.e.phase = st.e.illum = st.e.age = st.e.moondist = st.e.moonang
+        = st.e.sundist = st.e.sunang = st.prev = st.next = k;
+    moonshm_publish(m, &st);
+  }
+  return NULL;
+}
+
+static int bench_shm(void)
+{
+  char name[64];
+  struct moon_shm *w, *r;
+  struct moon_state st;
+  pthread_t th;
+  size_t torn = 0, fails = 0;
+  double t;
+
+  snprintf(name, sizeof(name), "/moonbench.%d", (int)getpid());
+  if (!(w = moonshm_open(name, 1)) || !(r = moonshm_open(name, 0)))
+    perror(name), exit(2);
+  shm_unlink(name);
+  shmstop = 0;
+  pthread_create(&th, NULL, shmwriter, w);
+  /* Nothing is there to read before the writer's first publish */
+  while (moonshm_read(r, &st))
+    sched_yield();
+  t = now();
+  for (size_t n = 0; n < count; n++) {
+    if (moonshm_read(r, &st)) {
+      fails++;
+      continue;
+    }
+    torn += !(st.time == st.lunation && st.index == (int32_t)st.time && st.which == st.index
+        && st.jd == st.time && st.e.phase == st.jd && st.e.illum == st.jd && st.e.age == st.jd
+        && st.e.moondist == st.jd && st.e.moonang == st.jd && st.e.sundist == st.jd
+        && st.e.sunang == st.jd && st.prev == st.jd && st.next == st.jd);
+  }
+  t = now() - t;
+  shmstop = 1;
+  pthread_join(th, NULL);
+  moonshm_close(w), moonshm_close(r);
+  if (check && fails == count)
+    return printf("shm: all %zu reads failed\n", fails), 1;
+  if (check)
+    return report("shm", "torn reads", torn, 0);
+  printf("%-8s moonshm_read() %6.2f Mreads/s while publishing, %zu retries exhausted\n",
+      "shm", count / t / 1e6, fails);
+  return 0;
+}
+
+// FORMATTED --  moon_format() of fmt at t, into buf
+static char *formatted(char *buf, size_t size, const char *fmt, time_t t)
+{
+  struct moon_ephem e;
+  FILE *f = fmemopen(buf, size, "w");
+
+  if (!f) perror("moonbench"), exit(2);
+  ephemeris(moon_jd(t), &e);
+  moon_format(f, fmt, t, &e);
+  fclose(f);
+  return buf;
+}
+
+static int bench_next(void)
+{
+  static const char *fmts[] = { "%p %e (%P%%)", "%a", "%L", "%D %d", "%U %u", "%N %s", "%E %J" };
+  size_t nf = sizeof(fmts) / sizeof(*fmts), n = count / 1000 + 1, differ = 0, secs = 0;
+  double *jd = range(n, 2415020.5, 2488069.5), t = now(); /* 1900 to 2100 */
+  char a[256], b[256];
+
+  for (size_t f = 0; f < nf; f++) {
+    struct moon_fmt *p = moon_fmt_compile(fmts[f], NULL);
+
+    for (size_t i = 0; i < n; i++) {
+      time_t t0 = (jd[i] - 2440587.5) * 86400, t1 = moon_fmt_next(p, t0);
+
+      secs += t1 - t0;
+      if (!check) continue;
+      /* The same up to t1, and a change there unless a day passed */
+      formatted(a, sizeof(a), fmts[f], t0);
+      for (int k = 1; k <= 16; k++)
+        differ += strcmp(a, formatted(b, sizeof(b), fmts[f], t0 + (t1 - t0) * k / 16 - (k == 16))) != 0;
+      differ += t1 - t0 < 86400 && !strcmp(a, formatted(b, sizeof(b), fmts[f], t1));
+    }
+    moon_fmt_free(p);
+  }
+  free(jd);
+  if (check)
+    return report("next", "mismatches", differ, 0);
+  t = now() - t;
+  printf("%-8s moon_fmt_next() %6.2f us per call, changes %.0f s apart on average\n",
+      "next", t / (n * nf) * 1e6, (double)secs / (n * nf));
+  return 0;
+}
+
+// PRINTF --  The numeric specifiers as printf() writes them
+static size_t printf_line(char *buf, size_t size, time_t t)
+{
+  struct moon_ephem e;
+  double jd = moon_jd(t);
+
+  ephemeris(jd, &e);
+  return snprintf(buf, size, "%2.1f %f %2.1f %d %ld %.0f %.4f %.0f %.4f\n", e.age, jd,
+      e.illum * 100, phaseindex(e.illum, e.age), lunation(jd), e.moondist, e.moonang, e.sundist, e.sunang);
+}
+
+static int bench_format(void)
+{
+  struct moon_fmt *p = moon_fmt_compile("%a %J %P %N %L %D %d %U %u", NULL);
+  double *jd = dates(count), t;
+  char a[256], b[256];
+  size_t differ = 0, sink = 0;
+
+  if (!p) perror("moonbench"), exit(2);
+  if (check) {
+    for (size_t i = 0; i < count; i++) {
+      time_t tt = (jd[i] - 2440587.5) * 86400;
+      size_t n = moon_fmt_run(p, tt, a, sizeof(a));
+
+      differ += n != printf_line(b, sizeof(b), tt) || memcmp(a, b, n);
+    }
+    moon_fmt_free(p), free(jd);
+    return report("format", "mismatches", differ, 0);
+  }
+  t = now();
+  for (size_t i = 0; i < count; i++)
+    sink += printf_line(b, sizeof(b), (jd[i] - 2440587.5) * 86400);
+  report("format", "snprintf()", count / (now() - t) / 1e6, 0);
+  t = now();
+  for (size_t i = 0; i < count; i++)
+    sink += moon_fmt_run(p, (jd[i] - 2440587.5) * 86400, a, sizeof(a));
+  report("format", "moon_fmt_run()", count / (now() - t) / 1e6, 0);
+  if (sink == 1) puts("");
+  moon_fmt_free(p), free(jd);
+  return 0;
+}
+
+static int bench_range(void)
+{
+  static char *fmts[] = { "%E %J %a %P %p", "%J %L %D %d %U %u %N", "%p %e (%P%%)" };
+  static char buf[1 << 16];
+  char line[256];
+  size_t differ = 0, rows = 0, done, n;
+  double t;
+
+  for (size_t f = 0; f < sizeof(fmts) / sizeof(*fmts); f++) {
+    struct moon_fmt *p = moon_fmt_compile(fmts[f], NULL);
+    time_t t0 = -2208988800 + 7919; /* 1900, and some */
+
+    if (!p) perror("moonbench"), exit(2);
+    t = now();
+    for (rows = 0; rows < count; rows += done, t0 += done * 4099) {
+      n = moon_fmt_range(p, t0, 4099, count - rows, buf, sizeof(buf), &done);
+      if (!check) continue;
+      /* The same as a line at a time */
+      for (size_t i = 0, off = 0; i < done; i++, off += n) {
+        n = moon_fmt_run(p, t0 + i * 4099, line, sizeof(line));
+        differ += memcmp(buf + off, line, n) != 0;
+      }
+    }
+    if (!check)
+      report("range", fmts[f], count / (now() - t) / 1e6, 0);
+    moon_fmt_free(p);
+  }
+  return check ? report("range", "mismatches", differ, 0) : 0;
+}
+
+// DATE  --  date_parse_r() on dates in several layouts, against the
+//	     strptime() loop it replaced, which tried these formats in turn,
+//	     and date_parse_ctx() going by the time zone read once
+static int bench_date(void)
+{
+  static const char *fmts[] = {
+    "%d/%m/%Y %T", "%d/%m/%Y", "%d-%b-%Y %T", "%d-%b-%Y", "%d %b %Y %r",
+    "%d %b %Y %T", "%d %b %Y %H:%M", "%d %b %Y", "%a %b %d %T %Y", "%a %b %d", NULL
+  };
+  static const int layouts[] = { 0, 1, 2, 6, 8 };
+  extern long timezone;
+  size_t nl = sizeof(layouts) / sizeof(*layouts), n = count / nl + 1, differ = 0;
+  double t[3];
+  struct date_ctx c;
+  char (*s)[64] = malloc(n * sizeof(*s));
+  time_t sink = 0, d;
+  struct tm tm;
+  int k;
+
+  if (!s) perror("moonbench"), exit(2);
+  date_ctx_init(&c);
+  for (size_t l = 0; l < nl; l++) {
+    const char *fmt = fmts[layouts[l]];
+
+    // In order, as in a log, about a minute apart from 1981
+    for (size_t i = 0; i < n; i++) {
+      time_t tt = 361411200 + (time_t)i * 61;
+      strftime(s[i], sizeof(*s), fmt, gmtime_r(&tt, &tm));
+    }
+    t[0] = now();
+    for (size_t i = 0; i < n; i++) {
+      memset(&tm, 0, sizeof(tm)), k = 0;
+      tzset();
+      while (!strptime(s[i], fmts[k], &tm) && fmts[++k]) ;
+      d = mktime(&tm) - timezone;
+      if (check) {
+        time_t p, pc;
+        differ += date_parse_r(s[i], &p) || p != d || date_parse_ctx(s[i], &pc, &c) || pc != d;
+      }
+      sink += d;
+    }
+    t[0] = now() - t[0];
+    t[1] = now();
+    for (size_t i = 0; i < n; i++)
+      date_parse_r(s[i], &d), sink += d;
+    t[1] = now() - t[1];
+    t[2] = now();
+    for (size_t i = 0; i < n; i++)
+      date_parse_ctx(s[i], &d, &c), sink += d;
+    t[2] = now() - t[2];
+    if (!check)
+      printf("%-8s %-16s %6.2f Mdates/s strptime() loop, %6.2f date_parse_r(), %6.2f date_parse_ctx()\n",
+          "date", fmt, n / t[0] / 1e6, n / t[1] / 1e6, n / t[2] / 1e6);
+  }
+
+  // ISO 8601 in UTC and with an offset, one by one and as a batch of slices
+  struct date_slice *sl = malloc(n * sizeof(*sl));
+  time_t *out = malloc(n * sizeof(*out));
+  if (!sl || !out) perror("moonbench"), exit(2);
+  for (size_t i = 0; i < n; i++) {
+    time_t tt = 361411200 + (time_t)i * 61;
+    sl[i].s = s[i];
+    sl[i].len = strftime(s[i], sizeof(*s), i % 2 ? "%Y-%m-%dT%H:%M:%SZ" : "%Y-%m-%dT%H:%M:%S.250+05:30",
+        gmtime_r(&tt, &tm));
+  }
+  t[0] = now();
+  for (size_t i = 0; i < n; i++) {
+    date_parse_ctx(s[i], &d, &c), sink += d;
+    if (check) differ += d != 361411200 + (time_t)i * 61 - (i % 2 ? 0 : 19800);
+  }
+  t[0] = now() - t[0];
+  t[1] = now();
+  differ += date_parse_batch(sl, n, out, NULL, &c);
+  t[1] = now() - t[1];
+  for (size_t i = 0; i < n; i++)
+    sink += out[i], differ += check && out[i] != 361411200 + (time_t)i * 61 - (i % 2 ? 0 : 19800);
+  if (!check)
+    printf("%-8s %-16s %6.2f Mdates/s date_parse_ctx(), %6.2f date_parse_batch()\n",
+        "date", "ISO 8601", n / t[0] / 1e6, n / t[1] / 1e6);
+  free(sl), free(out);
+  if (sink == 1) puts("");
+  free(s);
+  return check ? report("date", "mismatches", differ, 0) : 0;
+}
+
+// REF_JD  --  moon_jd() as it was: gmtime_r(), then the day by centuries
+static double ref_jd(time_t t)
+{
+  struct tm tm;
+  long c, m, y;
+
+  if (!gmtime_r(&t, &tm))
+    return NAN;
+  y = tm.tm_year + 1900, m = tm.tm_mon + 1;
+  if (m > 2) m -= 3;
+  else { m += 9; y--; }
+  c = y / 100L;
+  y -= 100L * c;
+  return ((tm.tm_mday + (c * 146097L) / 4 + (y * 1461L) / 4 + (m * 153L + 2) / 5 + 1721119L) - 0.5)
+      + (tm.tm_sec + 60 * (tm.tm_min + 60 * tm.tm_hour)) / 86400.0;
+}
+
+// TIMES  --  Pseudo-random times, mostly 1800 to 2200, some up to 2^39
+//	      and 2^54 seconds (500 million years) either way, and some
+//	      a second either side of midnight
+static int64_t *times(size_t n)
+{
+  int64_t *t = malloc(n * sizeof(*t));
+  unsigned long x = 88172645463325252UL;
+
+  if (!t) perror("moonbench"), exit(2);
+  for (size_t i = 0; i < n; i++) {
+    x ^= x << 13, x ^= x >> 7, x ^= x << 17;
+    switch (i % 8) {
+    case 0: t[i] = (int64_t)(x >> 24) - ((int64_t)1 << 39); break;
+    case 1: t[i] = (int64_t)(x >> 9) - ((int64_t)1 << 54); break;
+    case 2: t[i] = 86400 * ((int64_t)(x >> 32) - ((int64_t)1 << 31)) + (int64_t)(x % 3) - 1; break;
+    default: t[i] = -5364662400 + (int64_t)(x % 12622780800); break;
+    }
+  }
+  return t;
+}
+
+static int bench_civil(void)
+{
+  int64_t *t = times(count);
+  double *jd = malloc(count * sizeof(*jd)), tt[3], sink = 0;
+  size_t differ = 0, i;
+  struct tm a, b;
+
+  if (!jd) perror("moonbench"), exit(2);
+  if (check) {
+    for (i = 0; i < count; i++) {
+      struct tm *g = gmtime_r(&(time_t){ t[i] }, &a), *c = civil_tm(t[i], &b);
+      double r = ref_jd(t[i]);
+
+      // The old day number divided by truncation, which went wrong before 1 AD
+      if (g && a.tm_year > -1900)
+        differ += memcmp(&r, &(double){ civil_jd(t[i]) }, sizeof(r)) != 0;
+      differ += !g != !c;
+      if (g && c)
+        differ += a.tm_year != b.tm_year || a.tm_mon != b.tm_mon || a.tm_mday != b.tm_mday
+            || a.tm_hour != b.tm_hour || a.tm_min != b.tm_min || a.tm_sec != b.tm_sec
+            || a.tm_wday != b.tm_wday || a.tm_yday != b.tm_yday || civil_time(&b) != t[i];
+    }
+    free(t), free(jd);
+    return report("civil", "mismatches", differ, 0);
+  }
+  memset(jd, 0, count * sizeof(*jd));
+  tt[0] = now();
+  for (i = 0; i < count; i++)
+    sink += ref_jd(t[i]);
+  tt[0] = now() - tt[0];
+  tt[1] = now();
+  for (i = 0; i < count; i++)
+    jd[i] = civil_jd(t[i]);
+  tt[1] = now() - tt[1];
+  sink += jd[count / 2];
+  tt[2] = now();
+  for (i = 0; i < count; i++)
+    sink += civil_tm(t[i], &b) ? b.tm_mday : 0;
+  tt[2] = now() - tt[2];
+  printf("%-8s %6.2f Mtimes/s gmtime_r() and jdate(), %6.2f civil_jd(), %6.2f civil_tm()\n",
+      "civil", count / tt[0] / 1e6, count / tt[1] / 1e6, count / tt[2] / 1e6);
+  if (sink == 1) puts("");
+  free(t), free(jd);
+  return 0;
+}
+
+/* A series of lines worked by par_run(), hashed in the order handed on */
+#define SCALE_LINES 4096
+
+struct scale {
+  struct moon_fmt *p;
+  uint64_t hash;
+};
+
+static int scale_work(void *arg, size_t k, struct par_buf *b)
+{
+  struct scale *sc = arg;
+  size_t done, n = SCALE_LINES, i = k * SCALE_LINES;
+
+  if (!b->s && !(b->s = malloc(b->cap = SCALE_LINES * 128)))
+    return -1;
+  for (; n; n -= done, i += done)
+    if (b->len += moon_fmt_range(sc->p, -2208988800 + (time_t)i * 3607, 3607, n,
+        b->s + b->len, b->cap - b->len, &done), !done)
+      return -1;
+  return 0;
+}
+
+static int scale_emit(void *arg, const struct par_buf *b)
+{
+  struct scale *sc = arg;
+
+  for (size_t i = 0; i < b->len; i++)
+    sc->hash = (sc->hash ^ (unsigned char)b->s[i]) * 0x100000001b3;
+  return 0;
+}
+
+static int bench_scale(void)
+{
+  struct scale sc = { moon_fmt_compile("%J %a %P %p %D", NULL), 0 };
+  size_t nchunks = count / SCALE_LINES + 1;
+  int ncpu = par_threads(0), last = check ? (ncpu > 4 ? ncpu : 4) : ncpu;
+  uint64_t first = 0;
+  size_t differ = 0;
+  double t;
+  char what[32];
+
+  if (!sc.p) perror("moonbench"), exit(2);
+  for (int n = 1; n <= last; n++) {
+    sc.hash = 0xcbf29ce484222325;
+    t = now();
+    if (par_run(nchunks, n, scale_work, scale_emit, &sc)) perror("moonbench"), exit(2);
+    t = now() - t;
+    if (n == 1) first = sc.hash;
+    differ += sc.hash != first;
+    snprintf(what, sizeof(what), "mprintf -r, %d thread%s", n, n > 1 ? "s" : "");
+    if (!check) report("scale", what, nchunks * SCALE_LINES / t / 1e6, 0);
+  }
+  moon_fmt_free(sc.p);
+  return check ? report("scale", "outputs differing", differ, 0) : 0;
+}
+
+static struct {
+  char *name;
+  int (*fn)(void);
+} tests[] = {
+  { "batch", bench_batch },
+  { "cheb", bench_cheb },
+  { "truephase", bench_truephase },
+  { "phasetab", bench_phasetab },
+  { "cursor", bench_cursor },
+  { "bucket", bench_bucket },
+  { "tiers", bench_tiers },
+  { "isa", bench_isa },
+  { "shm", bench_shm },
+  { "next", bench_next },
+  { "format", bench_format },
+  { "range", bench_range },
+  { "scale", bench_scale },
+  { "date", bench_date },
+  { "civil", bench_civil },
+};
+
+#define NTESTS (sizeof(tests) / sizeof(*tests))
+
+int main(int argc, char **argv)
+{
+  int fail = 0;
+  size_t t;
+
+  for (int i = 0; (i = getopt(argc, argv, "hcn:")) != -1; ) switch (i) {
+    case 'h': puts(help); exit(1);
+    case 'c': check = 1; break;
+    case 'n': count = strtoul(optarg, NULL, 10); break;
+    default: puts("Error: Unknown Option\n"HELPTXT); exit(1);
+    }
+  if (!count) puts("Error: Bad count\n"HELPTXT), exit(1);
+  unsetenv("MOONTAB"); /* Time phasehunt2() itself */
+
+  for (int i = optind; i < argc; i++) {
+    for (t = 0; t < NTESTS && strcmp(argv[i], tests[t].name); t++) ;
+    if (t == NTESTS) dprintf(2, "Unknown test: `%s`\n", argv[i]), exit(1);
+  }
+  for (t = 0; t < NTESTS; t++) {
+    int run = optind == argc;
+
+    for (int i = optind; i < argc; i++)
+      run |= !strcmp(argv[i], tests[t].name);
+    if (run) fail |= tests[t].fn();
+  }
+  if (check && !fail) puts("ok");
+  return fail;
+}
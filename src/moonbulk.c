@@ -0,0 +1,544 @@
+/* moonbulk - the phase of the moon for arrays of times, in binary
+** See LICENSE
+**
+** Input is raw little-endian Unix times, int64 or double; output is the
+** records or column files laid out in moonbulk.h.  Both are mapped, so
+** every record's place is known before any of them is computed.  With -g
+** the times, which may be text then, are only counted into bins instead.
+*/
+
+#include <ctype.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "moon.h"
+#include "moonbulk.h"
+#include "par.h"
+
+#define HELPTXT "moonbulk [-hd] [-c COLUMNS] [-j THREADS] [-o FILE | -C PREFIX] [INPUT]\n" \
+                "moonbulk [-dt] [-j THREADS] -g KEY[:BINS] [INPUT]\n" \
+                "moonbulk -p FILE...\n"
+char *help = HELPTXT
+"-d INPUT holds doubles rather than int64s, Unix seconds either way\n"
+"-c columns to write, of jd,illum,age,lunation,index (default all)\n"
+"-j threads to compute with (default one per CPU)\n"
+"-o write records to FILE\n"
+"-C write each column to its own file, PREFIX.NAME\n"
+"-p print moonbulk files as text\n"
+"-t INPUT holds text, a time per line in Unix seconds, with -g\n"
+"-g count the times by index, lunation, illum:BINS or age:BINS (default 10)\n"
+"INPUT defaults to stdin";
+
+/* The columns, doubles first so that they stay aligned in any record */
+enum { COL_JD, COL_ILLUM, COL_AGE, COL_LUNATION, COL_INDEX, NCOLS };
+
+static const struct {
+  char *name;
+  int type;
+} cols[NCOLS] = {
+  { "jd", MOONBULK_F64 },
+  { "illum", MOONBULK_F64 },
+  { "age", MOONBULK_F64 },
+  { "lunation", MOONBULK_I32 },
+  { "index", MOONBULK_I32 },
+};
+
+/* Input times, mapped or read whole */
+struct in {
+  const unsigned char *p;
+  size_t count;
+  int dbl, text;
+  size_t len; /* Bytes */
+  size_t maplen; /* Of p if mapped, else 0 and p is malloc'd */
+};
+
+/* An output file mapped for writing */
+struct out {
+  unsigned char *map;
+  size_t len;
+  uint32_t data, recsize;
+  int off[NCOLS]; /* Of each column in a record, or -1 */
+};
+
+static void put16(unsigned char *p, uint16_t v)
+{
+  p[0] = v, p[1] = v >> 8;
+}
+
+static void put32(unsigned char *p, uint32_t v)
+{
+  for (int i = 0; i < 4; i++)
+    p[i] = v >> 8 * i;
+}
+
+static void put64(unsigned char *p, uint64_t v)
+{
+  for (int i = 0; i < 8; i++)
+    p[i] = v >> 8 * i;
+}
+
+static uint16_t get16(const unsigned char *p)
+{
+  return p[0] | p[1] << 8;
+}
+
+static uint32_t get32(const unsigned char *p)
+{
+  return p[0] | p[1] << 8 | (uint32_t)p[2] << 16 | (uint32_t)p[3] << 24;
+}
+
+static uint64_t get64(const unsigned char *p)
+{
+  return get32(p) | (uint64_t)get32(p + 4) << 32;
+}
+
+static double getf64(const unsigned char *p)
+{
+  uint64_t u = get64(p);
+  double d;
+
+  memcpy(&d, &u, sizeof(d));
+  return d;
+}
+
+static void putf64(unsigned char *p, double d)
+{
+  uint64_t u;
+
+  memcpy(&u, &d, sizeof(u));
+  put64(p, u);
+}
+
+// COLUMNS  --  The mask of the columns named in a list like jd,illum
+static unsigned columns(char *list)
+{
+  unsigned mask = 0;
+  int c;
+
+  for (char *s = strtok(list, ","); s; s = strtok(NULL, ",")) {
+    for (c = 0; c < NCOLS && strcmp(s, cols[c].name); c++) ;
+    if (c == NCOLS) dprintf(2, "Unknown column: `%s`\n", s), exit(1);
+    mask |= 1 << c;
+  }
+  return mask;
+}
+
+// OPENIN  --  The times in path, or stdin if path is NULL
+static void openin(struct in *in, const char *path)
+{
+  struct stat st;
+  unsigned char *buf = NULL;
+  size_t len = 0, cap = 0;
+  ssize_t n;
+  int fd = path ? open(path, O_RDONLY) : 0;
+
+  if (fd < 0 || fstat(fd, &st)) perror(path ? path : "stdin"), exit(2);
+  in->maplen = 0;
+  if (S_ISREG(st.st_mode) && st.st_size > 0) {
+    void *map = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+
+    if (map == MAP_FAILED) perror(path ? path : "stdin"), exit(2);
+    madvise(map, st.st_size, MADV_SEQUENTIAL);
+    in->p = map;
+    len = in->maplen = st.st_size;
+  } else {
+    // A pipe: read it all
+    do {
+      if (len == cap && !(buf = realloc(buf, cap = cap ? 2 * cap : 1 << 16)))
+        perror("moonbulk"), exit(2);
+      if ((n = read(fd, buf + len, cap - len)) < 0) perror(path ? path : "stdin"), exit(2);
+      len += n;
+    } while (n);
+    in->p = buf;
+  }
+  if (path) close(fd);
+  in->len = len;
+  if (in->text) return;
+  if (len % 8) dprintf(2, "%s: not a whole number of times\n", path ? path : "stdin"), exit(2);
+  in->count = len / 8;
+}
+
+// OPENOUT  --  Create path for count records of the columns in mask, and map it
+static void openout(struct out *o, const char *path, unsigned mask, size_t count)
+{
+  unsigned char *h;
+  uint32_t ncols = 0, off = 0;
+  int fd;
+
+  for (int c = 0; c < NCOLS; c++) {
+    o->off[c] = -1;
+    if (!(mask & 1 << c)) continue;
+    o->off[c] = off;
+    off += cols[c].type == MOONBULK_F64 ? 8 : 4;
+    ncols++;
+  }
+  o->recsize = (off + 7) & ~7u;
+  o->data = sizeof(struct moonbulk_hdr) + ncols * sizeof(struct moonbulk_col);
+  o->len = o->data + count * o->recsize;
+  if ((fd = open(path, O_RDWR | O_CREAT | O_TRUNC, 0666)) < 0 || ftruncate(fd, o->len))
+    perror(path), exit(2);
+  if ((o->map = mmap(NULL, o->len, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0)) == MAP_FAILED)
+    perror(path), exit(2);
+  close(fd);
+
+  h = o->map;
+  memcpy(h, MOONBULK_MAGIC, 8);
+  put32(h + offsetof(struct moonbulk_hdr, version), MOONBULK_VERSION);
+  put32(h + offsetof(struct moonbulk_hdr, ncols), ncols);
+  put64(h + offsetof(struct moonbulk_hdr, count), count);
+  put32(h + offsetof(struct moonbulk_hdr, recsize), o->recsize);
+  put32(h + offsetof(struct moonbulk_hdr, data), o->data);
+  h += sizeof(struct moonbulk_hdr);
+  for (int c = 0; c < NCOLS; c++) {
+    if (o->off[c] < 0) continue;
+    strncpy((char *)h, cols[c].name, sizeof(((struct moonbulk_col *)0)->name));
+    put16(h + offsetof(struct moonbulk_col, type), cols[c].type);
+    put16(h + offsetof(struct moonbulk_col, offset), o->off[c]);
+    h += sizeof(struct moonbulk_col);
+  }
+}
+
+// JD  --  Julian dates of the w (up to 64) times from i, as mprintf works
+//	   them out for whole seconds
+static void jd(const struct in *in, size_t i, size_t w, double *day)
+{
+  if (in->dbl) {
+    for (size_t j = 0; j < w; j++)
+      day[j] = 2440587.5 + getf64(in->p + 8 * (i + j)) / 86400;
+    return;
+  }
+  for (size_t j = 0; j < w; j++)
+    day[j] = civil_jd((int64_t)get64(in->p + 8 * (i + j)));
+}
+
+// COMPUTE  --  Records i0 to i1 of every output
+static void compute(const struct in *in, const struct out *outs, int nouts, size_t i0, size_t i1)
+{
+  double day[64], frac[64], illum[64], age[64];
+  size_t w;
+
+  for (size_t i = i0; i < i1; i += w) {
+    w = i1 - i < 64 ? i1 - i : 64;
+    jd(in, i, w, day);
+    phase_batch(day, w, frac, illum, age);
+    for (size_t j = 0; j < w; j++) {
+      double f64[] = { day[j], illum[j], age[j] };
+      int32_t i32[] = { 0, phaseindex(illum[j], age[j]) };
+      int lun = 0;
+
+      for (int o = 0; o < nouts; o++) {
+        unsigned char *rec = outs[o].map + outs[o].data + (i + j) * outs[o].recsize;
+
+        for (int c = 0; c < NCOLS; c++) {
+          if (outs[o].off[c] < 0) continue;
+          if (c == COL_LUNATION && !lun++)
+            i32[0] = lunation(day[j]);
+          if (cols[c].type == MOONBULK_F64) putf64(rec + outs[o].off[c], f64[c]);
+          else put32(rec + outs[o].off[c], i32[c - COL_LUNATION]);
+        }
+      }
+    }
+  }
+}
+
+/* The records to compute, in chunks on a pool of threads */
+#define CHUNK 65536
+
+struct job {
+  const struct in *in;
+  const struct out *outs;
+  int nouts;
+};
+
+static int work(void *arg, size_t k, struct par_buf *b)
+{
+  const struct job *j = arg;
+  size_t i1 = (k + 1) * CHUNK < j->in->count ? (k + 1) * CHUNK : j->in->count;
+
+  (void)b;
+  compute(j->in, j->outs, j->nouts, k * CHUNK, i1);
+  return 0;
+}
+
+/*
+ * Counting.  Each thread counts into its own histogram, starting on a
+ * cache line of its own so that threads never write the same line, and
+ * the histograms are added up at the end.
+ */
+enum { KEY_INDEX, KEY_LUNATION, KEY_ILLUM, KEY_AGE };
+
+static const char *keys[] = { "index", "lunation", "illum", "age" };
+
+#define LINE 64 /* Bytes in a cache line */
+#define synmonth 29.53058868 /* Synodic month (new Moon to new Moon) */
+#define TEXTCHUNK (1 << 20) /* Bytes of text per chunk */
+
+struct hist {
+  uint64_t *n; /* Times in each bin */
+  long lo; /* Key of bin 0, for lunations */
+  size_t nbins;
+  char pad[LINE - sizeof(uint64_t *) - sizeof(long) - sizeof(size_t)];
+};
+
+struct group {
+  const struct in *in;
+  int key, bins;
+  struct hist *h; /* One per thread */
+  const char *bad; /* The first bad text time */
+  pthread_mutex_t lock; /* Over bad, which every worker may set */
+};
+
+static void *lines(size_t size)
+{
+  void *p;
+
+  if (posix_memalign(&p, LINE, (size + LINE - 1) / LINE * LINE)) perror("moonbulk"), exit(2);
+  return memset(p, 0, size);
+}
+
+// LUNBIN  --  The bin of lunation k, growing h to take it
+static uint64_t *lunbin(struct hist *h, long k)
+{
+  if (!h->nbins || k < h->lo || k >= h->lo + (long)h->nbins) {
+    // By 64 lunations more on the side of k
+    long lo = !h->nbins || k < h->lo ? k - 64 : h->lo;
+    long hi = h->nbins && k < h->lo ? h->lo + (long)h->nbins : k + 64;
+    uint64_t *n = lines((hi - lo) * sizeof(*n));
+
+    if (h->nbins) memcpy(n + (h->lo - lo), h->n, h->nbins * sizeof(*n));
+    free(h->n);
+    h->n = n, h->lo = lo, h->nbins = hi - lo;
+  }
+  return &h->n[k - h->lo];
+}
+
+// COUNT  --  Count the w times in day into h
+static void count(const struct group *g, struct hist *h, double *day, size_t w)
+{
+  double frac[64], illum[64], age[64];
+
+  if (g->key == KEY_LUNATION) {
+    for (size_t j = 0; j < w; j++)
+      ++*lunbin(h, lunation(day[j]));
+    return;
+  }
+  phase_batch(day, w, frac, illum, age);
+  for (size_t j = 0; j < w; j++) {
+    int b = g->key == KEY_INDEX ? phaseindex(illum[j], age[j])
+          : g->key == KEY_ILLUM ? (int)(illum[j] * g->bins)
+          : (int)(age[j] / synmonth * g->bins);
+
+    h->n[b < 0 ? 0 : b < g->bins ? b : g->bins - 1]++;
+  }
+}
+
+static int tally(void *arg, size_t k, struct par_buf *b)
+{
+  struct group *g = arg;
+  struct hist *h = &g->h[par_worker()];
+  const struct in *in = g->in;
+  double day[64];
+  size_t w = 0;
+
+  (void)b;
+  if (!in->text) {
+    size_t i1 = (k + 1) * CHUNK < in->count ? (k + 1) * CHUNK : in->count;
+
+    for (size_t i = k * CHUNK; i < i1; i += w) {
+      w = i1 - i < 64 ? i1 - i : 64;
+      jd(in, i, w, day);
+      count(g, h, day, w);
+    }
+    return 0;
+  }
+
+  // The times that start in this chunk, as @SECONDS or SECONDS
+  const char *s = (const char *)in->p + k * TEXTCHUNK, *end = (const char *)in->p + in->len;
+  const char *stop = (size_t)(end - s) > TEXTCHUNK ? s + TEXTCHUNK : end;
+  char *e;
+
+  if (k)
+    while (s < stop && !isspace((unsigned char)s[-1])) s++;
+  for (;;) {
+    while (s < stop && isspace((unsigned char)*s)) s++;
+    if (s >= stop || w == 64) {
+      count(g, h, day, w);
+      if (s >= stop) return 0;
+      w = 0;
+    }
+    const char *t = s + (*s == '@');
+    long long v = 0;
+    int neg = *t == '-';
+    for (t += neg || *t == '+', e = (char *)t; e < end && isdigit((unsigned char)*e); e++)
+      v = 10 * v + (*e - '0');
+    if (e == t || (e < end && !isspace((unsigned char)*e))) {
+      pthread_mutex_lock(&g->lock);
+      if (!g->bad || s < g->bad)
+        g->bad = s;
+      pthread_mutex_unlock(&g->lock);
+      return -1;
+    }
+    day[w++] = moon_jd(neg ? -v : v);
+    s = e;
+  }
+}
+
+// GROUPBY  --  Count the times in in into bins of key, and print the bins
+static void groupby(const struct in *in, int key, int bins, int nthreads)
+{
+  size_t chunks = in->text ? (in->len + TEXTCHUNK - 1) / TEXTCHUNK : (in->count + CHUNK - 1) / CHUNK;
+  struct group g = { in, key, key == KEY_INDEX ? 8 : bins, NULL, NULL, PTHREAD_MUTEX_INITIALIZER };
+  struct hist *all;
+
+  nthreads = par_threads(nthreads);
+  g.h = lines(nthreads * sizeof(*g.h));
+  for (int i = 0; key != KEY_LUNATION && i < nthreads; i++)
+    g.h[i].n = lines(g.bins * sizeof(uint64_t)), g.h[i].nbins = g.bins;
+  if (par_run(chunks, nthreads, tally, NULL, &g)) {
+    if (g.bad) {
+      int n = strcspn(g.bad, " \t\n");
+      dprintf(2, "Bad time: `%.*s`\n", n > 32 ? 32 : n, g.bad), exit(2);
+    }
+    perror("moonbulk"), exit(2);
+  }
+
+  // Added up into the first thread's
+  all = &g.h[0];
+  for (int i = 1; i < nthreads; i++) {
+    struct hist *h = &g.h[i];
+
+    for (size_t b = 0; b < h->nbins; b++) {
+      if (!h->n[b]) continue;
+      if (key == KEY_LUNATION) *lunbin(all, h->lo + b) += h->n[b];
+      else all->n[b] += h->n[b];
+    }
+  }
+  size_t b0 = 0, b1 = all->nbins;
+  while (key == KEY_LUNATION && b0 < b1 && !all->n[b0]) b0++;
+  while (key == KEY_LUNATION && b1 > b0 && !all->n[b1 - 1]) b1--;
+  printf("# %s count\n", keys[key]);
+  for (size_t b = b0; b < b1; b++) {
+    if (key == KEY_ILLUM) printf("%g", (double)b / g.bins);
+    else if (key == KEY_AGE) printf("%.2f", b * synmonth / g.bins);
+    else printf("%ld", (long)b + all->lo);
+    printf(" %llu\n", (unsigned long long)all->n[b]);
+  }
+}
+
+// PRINT  --  A moonbulk file as text, a record per line
+static void print(const char *path)
+{
+  struct stat st;
+  const unsigned char *h;
+  int fd = open(path, O_RDONLY);
+  uint32_t ncols, recsize, data;
+  uint64_t count;
+
+  if (fd < 0 || fstat(fd, &st)) perror(path), exit(2);
+  if ((size_t)st.st_size < sizeof(struct moonbulk_hdr)) goto bad;
+  if ((h = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0)) == MAP_FAILED) perror(path), exit(2);
+  close(fd);
+  ncols = get32(h + offsetof(struct moonbulk_hdr, ncols));
+  count = get64(h + offsetof(struct moonbulk_hdr, count));
+  recsize = get32(h + offsetof(struct moonbulk_hdr, recsize));
+  data = get32(h + offsetof(struct moonbulk_hdr, data));
+  if (memcmp(h, MOONBULK_MAGIC, 8) || get32(h + offsetof(struct moonbulk_hdr, version)) != MOONBULK_VERSION
+      || data < sizeof(struct moonbulk_hdr) + ncols * sizeof(struct moonbulk_col)
+      || (uint64_t)st.st_size != data + count * recsize)
+    goto bad;
+
+  const unsigned char *col = h + sizeof(struct moonbulk_hdr);
+  printf("#");
+  for (uint32_t c = 0; c < ncols; c++)
+    printf(" %.12s", col + c * sizeof(struct moonbulk_col));
+  putchar('\n');
+  for (uint64_t r = 0; r < count; r++) {
+    const unsigned char *rec = h + data + r * recsize;
+
+    for (uint32_t c = 0; c < ncols; c++) {
+      const unsigned char *d = col + c * sizeof(struct moonbulk_col);
+      unsigned type = get16(d + offsetof(struct moonbulk_col, type));
+      unsigned off = get16(d + offsetof(struct moonbulk_col, offset));
+
+      if (off + (type == MOONBULK_F64 ? 8 : 4) > recsize) goto bad;
+      if (type == MOONBULK_F64) printf(&" %.17g"[!c], getf64(rec + off));
+      else printf(&" %d"[!c], (int32_t)get32(rec + off));
+    }
+    putchar('\n');
+  }
+  return;
+
+bad:
+  dprintf(2, "%s: not a moonbulk file\n", path), exit(2);
+}
+
+int main(int argc, char **argv)
+{
+  char *outpath = NULL, *prefix = NULL;
+  unsigned mask = (1 << NCOLS) - 1;
+  struct out outs[NCOLS];
+  struct in in = { 0 };
+  int nouts = 0, pflag = 0, nthreads = 0, key = -1, bins = 10;
+  char *colon;
+
+  for (int i = 0; (i = getopt(argc, argv, "hdc:j:o:C:ptg:")) != -1; ) switch (i) {
+    case 'h': puts(help); exit(1);
+    case 'd': in.dbl = 1; break;
+    case 'c': mask = columns(optarg); break;
+    case 'j': if ((nthreads = atoi(optarg)) < 1) puts("Error: Bad thread count\n"HELPTXT), exit(1); break;
+    case 'o': outpath = optarg; break;
+    case 'C': prefix = optarg; break;
+    case 'p': pflag = 1; break;
+    case 't': in.text = 1; break;
+    case 'g':
+      if ((colon = strchr(optarg, ':'))) *colon++ = 0;
+      for (key = 0; key < 4 && strcmp(optarg, keys[key]); key++) ;
+      if (key == 4 || (colon && (key < KEY_ILLUM || (bins = atoi(colon)) < 1)))
+        dprintf(2, "Unknown key: `%s%s%s`\n", optarg, colon ? ":" : "", colon ? colon : ""), exit(1);
+      break;
+    default: puts("Error: Unknown Option\n"HELPTXT); exit(1);
+    }
+  if (pflag) {
+    if (optind == argc) puts("Error: Bad arguments\n"HELPTXT), exit(1);
+    while (optind < argc) print(argv[optind++]);
+    return 0;
+  }
+  if (key >= 0) {
+    if (outpath || prefix || argc - optind > 1 || (in.text && in.dbl)) puts("Error: Bad arguments\n"HELPTXT), exit(1);
+    openin(&in, argv[optind]);
+    groupby(&in, key, bins, nthreads);
+    return 0;
+  }
+  if (!outpath == !prefix || !mask || in.text || argc - optind > 1) puts("Error: Bad arguments\n"HELPTXT), exit(1);
+
+  openin(&in, argv[optind]);
+  if (outpath)
+    openout(&outs[nouts++], outpath, mask, in.count);
+  else for (int c = 0; c < NCOLS; c++) {
+    char *path;
+
+    if (!(mask & 1 << c)) continue;
+    if (!(path = malloc(strlen(prefix) + strlen(cols[c].name) + 2))) perror("moonbulk"), exit(2);
+    sprintf(path, "%s.%s", prefix, cols[c].name);
+    openout(&outs[nouts++], path, 1 << c, in.count);
+    free(path);
+  }
+
+  // Every record has its place already, so the chunks go in any order
+  struct job j = { &in, outs, nouts };
+  if (par_run((in.count + CHUNK - 1) / CHUNK, par_threads(nthreads), work, NULL, &j))
+    perror("moonbulk"), exit(2);
+  for (int o = 0; o < nouts; o++)
+    if (munmap(outs[o].map, outs[o].len))
+      perror("moonbulk"), exit(2);
+  return 0;
+}
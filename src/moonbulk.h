@@ -0,0 +1,36 @@
+/* moonbulk - binary columns of the phase of the moon for many times
+** See LICENSE
+*/
+
+#ifndef MOONBULK_H
+#define MOONBULK_H
+
+#include <stdint.h>
+
+#define MOONBULK_MAGIC "MOONBULK"
+#define MOONBULK_VERSION 1
+
+/*
+ * File layout: this header, then ncols column descriptions, then count
+ * records of recsize bytes from the 8-aligned offset data.  A record holds
+ * each column at its offset.  A column file is the same with one column.
+ * Everything is little-endian, whatever the host.
+ */
+struct moonbulk_hdr {
+  char magic[8];
+  uint32_t version;
+  uint32_t ncols;
+  uint64_t count; /* Records */
+  uint32_t recsize; /* Bytes per record, a multiple of 8 */
+  uint32_t data; /* Offset of the first record */
+};
+
+enum { MOONBULK_F64 = 1, MOONBULK_I32 = 2 };
+
+struct moonbulk_col {
+  char name[12]; /* NUL padded */
+  uint16_t type;
+  uint16_t offset; /* In the record */
+};
+
+#endif
@@ -0,0 +1,568 @@
+/* moond - answer mprintf and phoon queries over a Unix domain socket
+** See LICENSE
+**
+** A request is a line, or "#LEN\n" followed by LEN bytes:
+**
+**	FMT TIME [FORMAT]	what mprintf -t TIME FORMAT prints
+**	PHOON TIME		what phoon TIME prints
+**	STATS			request counters and a latency histogram
+**
+** TIME is "now", "@SECONDS" or a date without spaces.  The answer is
+** "OK LEN\n" and LEN bytes, or "ERR reason\n".  Requests may be pipelined;
+** answers come back in order.
+**
+** A pool of workers waits on one epoll instance, each connection armed
+** one-shot so that only one worker reads it at a time.  Every wakeup
+** gathers the requests from all the connections that were ready, and
+** FMT requests for the same moment share one ephemeris() evaluation.
+** Ephemerides for the current minute are kept for the next request.
+**
+** With -p, the main thread also publishes the moon right now in a shared
+** memory segment every -i seconds, for mprintf --shm to read.
+*/
+
+#define _GNU_SOURCE /* accept4() */
+
+#include <errno.h>
+#include <math.h>
+#include <pthread.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/epoll.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "moon.h"
+
+#define DEFSOCKET "/tmp/moond.sock"
+#define MAXREQ 4096 /* Longest request */
+#define MAXEV 64 /* Connections served per wakeup */
+#define MAXWORKER 64
+#define NLAT 40 /* Latency buckets, powers of two of nanoseconds */
+
+#define HELPTXT "moond [-h] [-j WORKERS] [-s SOCKET] [-p SHM [-i SECONDS]] [-c REQUEST]\n"
+char *help = HELPTXT
+"-j number of worker threads (default 2)\n"
+"-p also publish the moon in shared memory segment SHM (e.g. "MOONSHM_NAME")\n"
+"-i seconds between updates of SHM (default 60)\n"
+"-s socket to listen on (default $MOOND_SOCKET, or "DEFSOCKET")\n"
+"-c send REQUEST to a running moond and print the answer\n"
+"requests: FMT TIME [FORMAT], PHOON TIME, STATS";
+
+struct conn {
+  int fd, eof;
+  size_t inlen;
+  char in[MAXREQ + 32];
+  char *out;
+  size_t outlen, outoff, outcap;
+};
+
+enum verb { FMT, PHOON, STATS, BAD };
+
+struct req {
+  struct conn *c;
+  enum verb verb;
+  time_t t;
+  double jd;
+  char *fmt;
+  const char *why; /* What is wrong with the request */
+  struct moon_ephem e;
+};
+
+enum { S_CONN, S_REQ, S_FMT, S_PHOON, S_STATS, S_ERR, S_HIT, S_EVAL, S_WAKE, NSTAT };
+
+static const char *statnames[NSTAT] = {
+  "connections", "requests", "fmt", "phoon", "stats", "errors",
+  "cache_hits", "evaluations", "wakeups",
+};
+
+/* Per worker, so that counting doesn't bounce cache lines */
+static struct stats {
+  unsigned long n[NSTAT];
+  unsigned long lat[NLAT];
+} __attribute__((aligned(64))) stats[MAXWORKER];
+
+static int epfd, lfd, nworker = 2;
+
+/* Ephemerides for the seconds of the current minute */
+static pthread_mutex_t cachelock = PTHREAD_MUTEX_INITIALIZER;
+static struct {
+  time_t t[60];
+  struct moon_ephem e[60];
+} cache;
+
+#define count(st, i, v) __atomic_fetch_add(&(st)->n[i], (v), __ATOMIC_RELAXED)
+
+static int
+slot(time_t t)
+{
+  return (t % 60 + 60) % 60;
+}
+
+static int
+cache_get(time_t t, struct moon_ephem *e)
+{
+  int hit;
+
+  pthread_mutex_lock(&cachelock);
+  if ((hit = cache.t[slot(t)] == t))
+    *e = cache.e[slot(t)];
+  pthread_mutex_unlock(&cachelock);
+  return hit;
+}
+
+static void
+cache_put(time_t t, const struct moon_ephem *e)
+{
+  if (t / 60 != time(0) / 60)
+    return;
+  pthread_mutex_lock(&cachelock);
+  cache.t[slot(t)] = t;
+  cache.e[slot(t)] = *e;
+  pthread_mutex_unlock(&cachelock);
+}
+
+static double
+now(void)
+{
+  struct timespec ts;
+
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+/*
+ * OUTPUT  --  Queue len bytes of data for c.  Returns 0, or -1 if out of
+ *		memory, in which case the connection is given up.
+ */
+static int
+output(struct conn *c, const char *data, size_t len)
+{
+  char *p;
+
+  if (c->outlen + len > c->outcap) {
+    size_t cap = 2 * (c->outlen + len);
+
+    if (!(p = realloc(c->out, cap)))
+      return c->eof = 1, -1;
+    c->out = p, c->outcap = cap;
+  }
+  memcpy(c->out + c->outlen, data, len);
+  c->outlen += len;
+  return 0;
+}
+
+static void
+answer(struct conn *c, const char *data, size_t len)
+{
+  char hdr[32];
+
+  output(c, hdr, snprintf(hdr, sizeof(hdr), "OK %zu\n", len));
+  output(c, data, len);
+}
+
+static void
+refuse(struct conn *c, const char *why)
+{
+  output(c, "ERR ", 4);
+  output(c, why, strlen(why));
+  output(c, "\n", 1);
+}
+
+/*
+ * PARSE  --  Make a request of the payload p, or say what is wrong with it
+ *		in why.
+ */
+static void
+parse(struct req *r, char *p)
+{
+  char *when = p + strcspn(p, " "), *fmt;
+
+  r->verb = BAD;
+  r->fmt = NULL;
+  r->why = "unknown request";
+  if (*when) *when++ = 0;
+  if (!strcmp(p, "STATS") && !*when) {
+    r->verb = STATS;
+    return;
+  }
+  if (strcmp(p, "FMT") && strcmp(p, "PHOON"))
+    return;
+
+  fmt = when + strcspn(when, " ");
+  if (*fmt) *fmt++ = 0;
+  else fmt = NULL;
+  r->why = "bad time";
+  if (!strcmp(when, "now")) r->t = time(0);
+  else if (!*when || date_parse_r(when, &r->t)) return;
+
+  if (*p == 'P') {
+    r->why = "PHOON takes only a time";
+    if (!fmt) r->verb = PHOON;
+    return;
+  }
+  r->jd = moon_jd(r->t);
+  r->why = "out of memory";
+  if ((r->fmt = strdup(fmt ? fmt : "%p %e (%P%%)")))
+    r->verb = FMT;
+}
+
+/* A worker's requests from one wakeup */
+struct batch {
+  struct req *r;
+  size_t n, cap;
+};
+
+static struct req *
+newreq(struct batch *b, struct conn *c)
+{
+  if (b->n == b->cap) {
+    size_t cap = b->cap ? 2 * b->cap : 256;
+    struct req *r = realloc(b->r, cap * sizeof(*r));
+
+    if (!r) return NULL;
+    b->r = r, b->cap = cap;
+  }
+  b->r[b->n].c = c;
+  return &b->r[b->n++];
+}
+
+/*
+ * TAKE  --  Move the complete requests in c's input into b.  Returns 0, or
+ *		-1 if the input can't be a request.
+ */
+static int
+take(struct batch *b, struct conn *c)
+{
+  char *p = c->in, *end = c->in + c->inlen, *nl, buf[MAXREQ + 1];
+  struct req *r;
+  size_t len;
+
+  while (p < end && (nl = memchr(p, '\n', end - p))) {
+    if (!(r = newreq(b, c))) return -1;
+    if (*p == '#') {
+      len = strtoul(p + 1, NULL, 10);
+      if (len > MAXREQ) return -1;
+      if ((size_t)(end - nl - 1) < len) {
+        b->n--;
+        break;
+      }
+      memcpy(buf, nl + 1, len);
+      buf[len] = 0;
+      parse(r, buf);
+      p = nl + 1 + len;
+      continue;
+    }
+    *nl = 0;
+    if (nl > p && nl[-1] == '\r') nl[-1] = 0;
+    parse(r, p);
+    p = nl + 1;
+  }
+  c->inlen = end - p;
+  memmove(c->in, p, c->inlen);
+  return c->inlen == sizeof(c->in) ? -1 : 0;
+}
+
+/* READCONN  --  Read what c has sent, and take the requests in it */
+static void
+readconn(struct batch *b, struct conn *c)
+{
+  ssize_t n;
+
+  while ((n = read(c->fd, c->in + c->inlen, sizeof(c->in) - c->inlen)) != 0) {
+    if (n < 0) {
+      if (errno == EINTR) continue;
+      if (errno != EAGAIN) c->eof = 1;
+      return;
+    }
+    c->inlen += n;
+    if (take(b, c)) {
+      refuse(c, "bad request");
+      c->eof = 1;
+      return;
+    }
+  }
+  c->eof = 1;
+}
+
+static int
+byjd(const void *a, const void *b)
+{
+  const struct req *x = *(struct req *const *)a, *y = *(struct req *const *)b;
+
+  return (x->jd > y->jd) - (x->jd < y->jd);
+}
+
+/*
+ * EVALUATE  --  The ephemerides of the FMT requests in b: from the cache,
+ *		or once for each distinct moment among the rest.
+ */
+static void
+evaluate(struct batch *b, struct stats *st)
+{
+  struct req **miss = malloc(b->n * sizeof(*miss));
+  size_t i, j, n = 0;
+
+  for (i = 0; i < b->n; i++) {
+    struct req *r = &b->r[i];
+
+    if (r->verb != FMT) continue;
+    if (cache_get(r->t, &r->e)) count(st, S_HIT, 1);
+    else if (miss) miss[n++] = r;
+    else ephemeris(r->jd, &r->e), count(st, S_EVAL, 1);
+  }
+  if (!miss) return;
+  qsort(miss, n, sizeof(*miss), byjd);
+  for (i = 0; i < n; i = j) {
+    ephemeris(miss[i]->jd, &miss[i]->e);
+    cache_put(miss[i]->t, &miss[i]->e);
+    count(st, S_EVAL, 1);
+    for (j = i + 1; j < n && miss[j]->jd == miss[i]->jd; j++)
+      miss[j]->e = miss[i]->e;
+  }
+  free(miss);
+}
+
+/* STATSREPORT  --  The counters of all the workers, summed */
+static void
+statsreport(FILE *out)
+{
+  unsigned long v;
+  int i, w;
+
+  for (i = 0; i < NSTAT; i++) {
+    for (v = w = 0; w < nworker; w++)
+      v += __atomic_load_n(&stats[w].n[i], __ATOMIC_RELAXED);
+    fprintf(out, "%s %lu\n", statnames[i], v);
+  }
+  for (i = 0; i < NLAT; i++) {
+    for (v = w = 0; w < nworker; w++)
+      v += __atomic_load_n(&stats[w].lat[i], __ATOMIC_RELAXED);
+    if (v) fprintf(out, "latency_ns %lu %lu\n", 1UL << i, v);
+  }
+}
+
+/* RESPOND  --  Answer the requests in b, in order */
+static void
+respond(struct batch *b, struct stats *st)
+{
+  char *buf;
+  size_t len;
+  FILE *f;
+  int bad, err = 0;
+
+  for (size_t i = 0; i < b->n; i++) {
+    struct req *r = &b->r[i];
+
+    count(st, S_REQ, 1);
+    if (r->verb == BAD) {
+      count(st, S_ERR, 1);
+      refuse(r->c, r->why);
+      continue;
+    }
+    if (!(f = open_memstream(&buf, &len))) {
+      refuse(r->c, "out of memory");
+      continue;
+    }
+    bad = 0;
+    switch (r->verb) {
+    case FMT:
+      count(st, S_FMT, 1);
+      bad = moon_format(f, r->fmt, r->t, &r->e), err = errno;
+      break;
+    case PHOON:
+      count(st, S_PHOON, 1);
+      moon_render(f, r->t);
+      break;
+    default:
+      count(st, S_STATS, 1);
+      statsreport(f);
+    }
+    fclose(f);
+    if (bad) {
+      count(st, S_ERR, 1);
+      refuse(r->c, bad > 0 ? "unknown specifier" : err == ENOMEM ? "out of memory" : "bad format");
+    } else
+      answer(r->c, buf, len);
+    free(buf);
+    free(r->fmt);
+  }
+}
+
+/*
+ * FLUSH  --  Write what is queued for c.  Returns 0 once it is all gone,
+ *		1 if the socket is full, or -1 if the connection is lost.
+ */
+static int
+flush(struct conn *c)
+{
+  ssize_t n;
+
+  while (c->outoff < c->outlen) {
+    n = send(c->fd, c->out + c->outoff, c->outlen - c->outoff, MSG_NOSIGNAL);
+    if (n < 0 && errno == EINTR) continue;
+    if (n < 0) return errno == EAGAIN ? 1 : -1;
+    c->outoff += n;
+  }
+  c->outoff = c->outlen = 0;
+  return 0;
+}
+
+static void
+arm(int fd, unsigned events, void *ptr)
+{
+  struct epoll_event ev = { .events = events | EPOLLONESHOT, .data.ptr = ptr };
+
+  epoll_ctl(epfd, EPOLL_CTL_MOD, fd, &ev);
+}
+
+static void
+acceptall(struct stats *st)
+{
+  struct epoll_event ev = { .events = EPOLLIN | EPOLLONESHOT };
+  struct conn *c;
+  int fd;
+
+  while ((fd = accept4(lfd, NULL, NULL, SOCK_NONBLOCK | SOCK_CLOEXEC)) >= 0 || errno == EINTR) {
+    if (fd < 0) continue;
+    if (!(c = calloc(1, sizeof(*c)))) {
+      close(fd);
+      continue;
+    }
+    c->fd = fd;
+    ev.data.ptr = c;
+    if (epoll_ctl(epfd, EPOLL_CTL_ADD, fd, &ev)) close(fd), free(c);
+    else count(st, S_CONN, 1);
+  }
+  arm(lfd, EPOLLIN, NULL);
+}
+
+static void *
+worker(void *arg)
+{
+  struct stats *st = arg;
+  struct epoll_event ev[MAXEV];
+  struct batch b = { 0 };
+  struct conn *c;
+  double t0, lat;
+  int i, n, f;
+
+  for (;;) {
+    if ((n = epoll_wait(epfd, ev, MAXEV, -1)) < 0)
+      continue;
+    count(st, S_WAKE, 1);
+    t0 = now();
+    b.n = 0;
+    for (i = 0; i < n; i++)
+      if (!ev[i].data.ptr)
+        acceptall(st);
+      else if (ev[i].events & (EPOLLIN | EPOLLHUP | EPOLLERR))
+        readconn(&b, ev[i].data.ptr);
+    evaluate(&b, st);
+    respond(&b, st);
+
+    for (i = 0; i < n; i++) {
+      if (!(c = ev[i].data.ptr)) continue;
+      if ((f = flush(c)) == 1)
+        arm(c->fd, EPOLLOUT, c);
+      else if (f < 0 || c->eof) {
+        close(c->fd);
+        free(c->out), free(c);
+      } else
+        arm(c->fd, EPOLLIN, c);
+    }
+
+    /* Each request waited for the whole wakeup */
+    lat = (now() - t0) * 1e9;
+    for (i = 0; lat >= 2 && i < NLAT - 1; i++, lat /= 2) ;
+    if (b.n) __atomic_fetch_add(&st->lat[i], b.n, __ATOMIC_RELAXED);
+  }
+  return NULL;
+}
+
+/* CLIENT  --  Ask the moond on path req, and print the answer */
+static int
+client(const char *path, const char *req)
+{
+  char *ans;
+  size_t len;
+  int r = moond_query(path, req, &ans, &len);
+
+  if (r < 0) perror(path), exit(2);
+  if (r) dprintf(2, "moond: %s\n", ans);
+  else fwrite(ans, 1, len, stdout);
+  free(ans);
+  return r;
+}
+
+int main(int argc, char **argv)
+{
+  struct sockaddr_un sa = { .sun_family = AF_UNIX };
+  struct epoll_event ev = { .events = EPOLLIN | EPOLLONESHOT };
+  char *path = getenv("MOOND_SOCKET"), *req = NULL, *shmname = NULL;
+  struct timespec ts = { 60, 0 };
+  struct moon_shm *shm = NULL;
+  struct moon_state state;
+  pthread_t th;
+  sigset_t sigs;
+  int i;
+
+  if (!path || !*path) path = DEFSOCKET;
+  for (i = 0; (i = getopt(argc, argv, "hc:i:j:p:s:")) != -1; ) switch (i) {
+    case 'h': puts(help); exit(1);
+    case 'c': req = optarg; break;
+    case 'i': ts.tv_sec = atoi(optarg); break;
+    case 'j': nworker = atoi(optarg); break;
+    case 'p': shmname = optarg; break;
+    case 's': path = optarg; break;
+    default: puts("Error: Unknown Option\n"HELPTXT); exit(1);
+    }
+  if (req) return client(path, req);
+  if (nworker < 1 || nworker > MAXWORKER) puts("Error: Bad worker count\n"HELPTXT), exit(1);
+  if (ts.tv_sec < 1) puts("Error: Bad interval\n"HELPTXT), exit(1);
+  if (strlen(path) >= sizeof(sa.sun_path)) dprintf(2, "%s: name too long\n", path), exit(1);
+  strcpy(sa.sun_path, path);
+
+  if ((lfd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0)) < 0)
+    perror("socket"), exit(2);
+  if (!connect(lfd, (struct sockaddr *)&sa, sizeof(sa)))
+    dprintf(2, "%s: moond is already running\n", path), exit(1);
+  close(lfd);
+  unlink(path);
+  if ((lfd = socket(AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0)) < 0)
+    perror("socket"), exit(2);
+  if (bind(lfd, (struct sockaddr *)&sa, sizeof(sa)) || listen(lfd, SOMAXCONN))
+    perror(path), exit(2);
+
+  /* The workers never see a signal; this thread waits for them */
+  sigemptyset(&sigs);
+  sigaddset(&sigs, SIGINT);
+  sigaddset(&sigs, SIGTERM);
+  sigaddset(&sigs, SIGHUP);
+  pthread_sigmask(SIG_BLOCK, &sigs, NULL);
+  signal(SIGPIPE, SIG_IGN);
+
+  for (i = 0; i < 60; i++)
+    cache.t[i] = -1;
+  if ((epfd = epoll_create1(EPOLL_CLOEXEC)) < 0
+      || epoll_ctl(epfd, EPOLL_CTL_ADD, lfd, &ev))
+    perror("epoll"), exit(2);
+  for (i = 0; i < nworker; i++)
+    if (pthread_create(&th, NULL, worker, &stats[i]))
+      perror("pthread_create"), exit(2);
+
+  if (shmname && !(shm = moonshm_open(shmname, ts.tv_sec)))
+    perror(shmname), unlink(path), exit(2);
+  do
+    if (shm && !moon_state(time(0), &state))
+      moonshm_publish(shm, &state);
+  while (sigtimedwait(&sigs, NULL, shm ? &ts : NULL) < 0);
+  if (shm) shm_unlink(shmname);
+  unlink(path);
+  return 0;
+}
@@ -0,0 +1,80 @@
+/* moondc - ask moond a question
+** See LICENSE
+*/
+
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+#include "moon.h"
+
+/* Read exactly len bytes.  Returns 0, or -1 at an error or early EOF. */
+static int
+readall(int fd, char *buf, size_t len)
+{
+  ssize_t n;
+
+  for (; len; buf += n, len -= n)
+    if ((n = read(fd, buf, len)) <= 0) {
+      if (n < 0 && errno == EINTR) n = 0;
+      else return n ? -1 : (errno = EPROTO, -1);
+    }
+  return 0;
+}
+
+/*
+ * MOOND_QUERY  --  Send the request req to the moond listening on path and
+ *		wait for the answer.  Returns 0 with the answer in *ans
+ *		(*len bytes, NUL terminated, to be freed), 1 if moond
+ *		refused the request with the reason in *ans, or -1 with
+ *		errno set if moond couldn't be asked.
+ */
+int moond_query(const char *path, const char *req, char **ans, size_t *len)
+{
+  struct sockaddr_un sa = { .sun_family = AF_UNIX };
+  char hdr[32], *p;
+  size_t n = strlen(req), i;
+  int fd, ok;
+
+  *ans = NULL;
+  if (strlen(path) >= sizeof(sa.sun_path)) return errno = ENAMETOOLONG, -1;
+  strcpy(sa.sun_path, path);
+  if ((fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0)) < 0) return -1;
+  if (connect(fd, (struct sockaddr *)&sa, sizeof(sa))) goto fail;
+
+  i = snprintf(hdr, sizeof(hdr), "#%zu\n", n);
+  if (send(fd, hdr, i, MSG_NOSIGNAL) != (ssize_t)i
+      || send(fd, req, n, MSG_NOSIGNAL) != (ssize_t)n)
+    goto fail;
+
+  /* "OK LEN\n" then LEN bytes, or "ERR reason\n" */
+  for (i = 0; i < sizeof(hdr) - 1; i++)
+    if (readall(fd, hdr + i, 1) || hdr[i] == '\n') break;
+  if (i == sizeof(hdr) - 1 || hdr[i] != '\n') goto proto;
+  hdr[i] = 0;
+  if ((ok = !strncmp(hdr, "OK ", 3))) {
+    n = strtoul(hdr + 3, &p, 10);
+    if (*p || !(*ans = malloc(n + 1))) goto proto;
+    if (readall(fd, *ans, n)) goto fail;
+    (*ans)[n] = 0;
+  } else if (!strncmp(hdr, "ERR ", 4)) {
+    if (!(*ans = strdup(hdr + 4))) goto fail;
+    n = strlen(*ans);
+  } else goto proto;
+  close(fd);
+  if (len) *len = n;
+  return !ok;
+
+proto:
+  errno = EPROTO;
+fail:
+  ok = errno;
+  free(*ans), *ans = NULL;
+  close(fd);
+  errno = ok;
+  return -1;
+}
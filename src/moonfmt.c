@@ -0,0 +1,568 @@
+/* moonfmt - mprintf's format and phoon's picture, for any stream
+** See LICENSE
+**
+** The picture is from phoon, Copyright (C) 1986,1987,1988,1995 by Jef
+** Poskanzer <jef@mail.acme.com>.  All rights reserved.
+*/
+
+#include <errno.h>
+#include <math.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "moon.h"
+
+static const char *phasenames[] = { "New", "Waxing Crescent", "First Quarter", "Waxing Gibbous", "Full", "Waning Gibbous", "Last Quarter", "Waning Crescent" };
+static const char *emojis[]     = {"🌑", "🌒", "🌓", "🌔", "🌕",  "🌖", "🌗", "🌘"};
+static const char *emojis_south[]= {"🌑", "🌘", "🌗", "🌖", "🌕",  "🌔", "🌓", "🌒"};
+
+// MOON_JD  --  Julian date of t as mprintf takes it, for any time_t.
+double moon_jd(time_t t)
+{
+  return civil_jd(t);
+}
+
+/*
+ * A compiled format is a list of ops, each either a run of literal text
+ * (spec 0) or a specifier, with the quantities its specifiers need;
+ * NEED_SECOND marks %J or %E, which print something new every second.
+ */
+enum { NEED_JD = 1, NEED_PHASE = 2, NEED_EPHEM = 4, NEED_INDEX = 8, NEED_LUN = 16, NEED_SECOND = 32 };
+
+struct fmtop {
+  char spec;
+  uint32_t off, len; /* Of a run in lit */
+};
+
+struct moon_fmt {
+  unsigned need;
+  int unknown;
+  size_t nops;
+  char *lit;
+  struct fmtop ops[];
+};
+
+static void addlit(struct moon_fmt *p, size_t *nlit, char c)
+{
+  struct fmtop *op = p->nops ? &p->ops[p->nops - 1] : NULL;
+
+  if (!op || op->spec || op->off + op->len != *nlit)
+    op = &p->ops[p->nops++], op->spec = 0, op->off = *nlit, op->len = 0;
+  p->lit[(*nlit)++] = c;
+  op->len++;
+}
+
+/*
+ * MOON_FMT_COMPILE  --  Compile fmt, with literal runs merged and a note of
+ *		which quantities it needs.  Unknown specifiers are skipped
+ *		and counted in *unknown.  Returns NULL with errno EINVAL if
+ *		fmt ends in a lone %, or ENOMEM.
+ */
+struct moon_fmt *moon_fmt_compile(const char *fmt, int *unknown)
+{
+  size_t len = strlen(fmt), nlit = 0;
+  struct moon_fmt *p;
+
+  if (len >= UINT32_MAX) {
+    errno = ENOMEM;
+    return NULL;
+  }
+  /* Every op and literal byte uses up at least one byte of fmt, but the newline */
+  if (!(p = malloc(sizeof(*p) + (len + 1) * sizeof(struct fmtop) + len + 1)))
+    return NULL;
+  p->lit = (char *)&p->ops[len + 1];
+  p->need = 0;
+  p->unknown = 0;
+  p->nops = 0;
+  for (size_t i = 0; fmt[i]; i++) {
+    if (fmt[i] != '%') addlit(p, &nlit, fmt[i]);
+    else switch (fmt[++i]) {
+      case '\0': free(p); errno = EINVAL; return NULL;
+      case '%': addlit(p, &nlit, '%'); break;
+      case 'n': addlit(p, &nlit, '\n'); break;
+      case 't': addlit(p, &nlit, '\t'); break;
+      case 'J': p->need |= NEED_JD | NEED_SECOND; goto op;
+      case 'L': p->need |= NEED_JD | NEED_LUN; goto op;
+      case 'a': case 'P': p->need |= NEED_JD | NEED_PHASE; goto op;
+      case 'D': case 'd': case 'U': case 'u': p->need |= NEED_JD | NEED_EPHEM; goto op;
+      case 'e': case 's': case 'p': case 'N':
+        p->need |= NEED_JD | NEED_PHASE | NEED_INDEX; goto op;
+      case 'E': p->need |= NEED_SECOND; goto op;
+      op:
+        p->ops[p->nops++] = (struct fmtop){ fmt[i], 0, 0 };
+        break;
+      default : p->unknown++; break;
+    }
+  }
+  addlit(p, &nlit, '\n');
+  if (unknown)
+    *unknown = p->unknown;
+  return p;
+}
+
+void moon_fmt_free(struct moon_fmt *p)
+{
+  free(p);
+}
+
+// UDEC  --  n in decimal into s, at least width digits
+static size_t udec(char *s, uint64_t n, int width)
+{
+  char d[20];
+  size_t l = 0;
+
+  do d[l++] = '0' + n % 10; while ((n /= 10) || (int)l < width);
+  for (size_t i = 0; i < l; i++)
+    s[i] = d[l - 1 - i];
+  return l;
+}
+
+// DEC  --  n in decimal, into s
+static size_t dec(char *s, int64_t n)
+{
+  if (n >= 0)
+    return udec(s, n, 1);
+  *s = '-';
+  return 1 + udec(s + 1, -(uint64_t)n, 1);
+}
+
+/*
+ * FIXED  --  v with prec (at most 6) decimals, as printf("%.*f") writes it,
+ *		into s, which holds 64 bytes.  Scaling by a power of ten
+ *		rounds, so values within rounding of a tie, and any this
+ *		can't hold in an integer, go to snprintf().
+ */
+static size_t fixed(char *s, double v, int prec)
+{
+  static const double scale[] = { 1, 1e1, 1e2, 1e3, 1e4, 1e5, 1e6 };
+  static const uint64_t iscale[] = { 1, 10, 100, 1000, 10000, 100000, 1000000 };
+  double x = v * scale[prec], r, f;
+  uint64_t n;
+  size_t l;
+
+  if (signbit(x) || !(x < 0x1p52))
+    return snprintf(s, 64, "%.*f", prec, v);
+  r = floor(x);
+  f = x - r;
+  if (fabs(f - 0.5) <= x * 0x1p-50 + 0x1p-60)
+    return snprintf(s, 64, "%.*f", prec, v);
+  n = (uint64_t)r + (f > 0.5);
+  l = udec(s, n / iscale[prec], 1);
+  if (prec) {
+    s[l++] = '.';
+    l += udec(s + l, n % iscale[prec], prec);
+  }
+  return l;
+}
+
+// EXEC  --  Run p for the moon at t, Julian date jd, with ephemeris e, phase
+// index indx and lunation lun, into buf as moon_fmt_run() does.
+static size_t exec(const struct moon_fmt *p, time_t t, double jd, const struct moon_ephem *e, int indx, long lun, char *buf, size_t size)
+{
+  char num[64];
+  const char *s;
+  size_t n = 0, l;
+
+  for (size_t i = 0; i < p->nops; i++) {
+    const struct fmtop *op = &p->ops[i];
+
+    s = num;
+    switch (op->spec) {
+      case 0: s = p->lit + op->off, l = op->len; break;
+      case 'a': l = fixed(num, e->age, 1); break;
+      case 'E': l = dec(num, t); break;
+      case 'J': l = fixed(num, jd, 6); break;
+      case 'e': l = strlen(s = emojis[indx]); break;
+      case 's': l = strlen(s = emojis_south[indx]); break;
+      case 'p': l = strlen(s = phasenames[indx]); break;
+      case 'P': l = fixed(num, e->illum*100, 1); break;
+      case 'N': l = dec(num, indx); break;
+      case 'L': l = dec(num, lun); break;
+      case 'D': l = fixed(num, e->moondist, 0); break;
+      case 'd': l = fixed(num, e->moonang, 4); break;
+      case 'U': l = fixed(num, e->sundist, 0); break;
+      case 'u': l = fixed(num, e->sunang, 4); break;
+      default : l = 0; break;
+    }
+    if (l >= sizeof(num) && s == num)
+      l = sizeof(num) - 1;
+    if (n < size)
+      memcpy(buf + n, s, l < size - n ? l : size - n);
+    n += l;
+  }
+  return n;
+}
+
+/*
+ * MOON_FMT_RUN  --  The line p prints for the moon at t: up to size bytes
+ *		of it go into buf, with no terminating NUL, and the return
+ *		is its whole length.  Only what p uses is computed.
+ */
+size_t moon_fmt_run(const struct moon_fmt *p, time_t t, char *buf, size_t size)
+{
+  struct moon_ephem e = { 0 };
+  double jd = 0;
+  int indx = 0;
+  long lun = 0;
+
+  if (p->need & NEED_JD)
+    jd = moon_jd(t);
+  if (p->need & (NEED_PHASE | NEED_EPHEM))
+    ephemeris(jd, &e);
+  if (p->need & NEED_INDEX)
+    indx = phaseindex(e.illum, e.age);
+  if (p->need & NEED_LUN)
+    lun = lunation(jd);
+  return exec(p, t, jd, &e, indx, lun, buf, size);
+}
+
+/*
+ * MOON_FMT_RANGE  --  The lines p prints for the n times t, t + step, ...
+ *		into buf, as many whole lines as fit in size bytes.  Returns
+ *		the bytes written and sets *done to the lines.  The Julian
+ *		date is stepped in whole days and seconds, which is what
+ *		moon_jd() works out each time.  A format that needs only
+ *		the age, illumination and phase name is computed with
+ *		phase_batch() at the current tier, which is ephemeris()
+ *		itself below ASTRO_EXACT and agrees with it to 1e-12 at it.
+ */
+size_t moon_fmt_range(const struct moon_fmt *p, time_t t, long step, size_t n, char *buf, size_t size, size_t *done)
+{
+  struct moon_ephem e = { 0 };
+  double jd[64], frac[64], illum[64], age[64];
+  int32_t s;
+  long day = 0, sec = 0, dstep = step / 86400, sstep = step % 86400;
+  size_t len = 0, l, i = 0, j, w;
+
+  *done = 0;
+  if (n && (p->need & NEED_JD))
+    day = civil_day(t, &s) + 2440588, sec = s; /* 2440588 is 1970-01-01 */
+  for (; i < n; i += w) {
+    w = n - i < 64 ? n - i : 64;
+    for (j = 0; j < w; j++) {
+      jd[j] = (day - 0.5) + sec / 86400.0;
+      day += dstep, sec += sstep;
+      if (sec >= 86400) day++, sec -= 86400;
+      else if (sec < 0) day--, sec += 86400;
+    }
+    if ((p->need & (NEED_PHASE | NEED_EPHEM)) == NEED_PHASE)
+      phase_batch(jd, w, frac, illum, age);
+    /* Stepped in unsigned, as the time after the last can be past a time_t */
+    for (j = 0; j < w; j++, t = (time_t)((uint64_t)t + (uint64_t)step)) {
+      if (p->need & NEED_EPHEM)
+        ephemeris(jd[j], &e);
+      else if (p->need & NEED_PHASE)
+        e.illum = illum[j], e.age = age[j];
+      l = exec(p, t, jd[j], &e, (p->need & NEED_INDEX) ? phaseindex(e.illum, e.age) : 0,
+          (p->need & NEED_LUN) ? lunation(jd[j]) : 0, buf + len, size - len);
+      if (l > size - len)
+        return len;
+      len += l;
+      ++*done;
+    }
+  }
+  return len;
+}
+
+// PRINT  --  Compile fmt and write it for the moon at t, Julian date jd.
+// The lunation is *lun, or worked out if lun is NULL.
+static int print(FILE *out, const char *fmt, time_t t, double jd, const struct moon_ephem *e, int indx, const long *lun)
+{
+  struct moon_fmt *p = moon_fmt_compile(fmt, NULL);
+  char line[256], *buf = line;
+  size_t n;
+  long l;
+  int unknown;
+
+  if (!p)
+    return -1;
+  l = lun ? *lun : (p->need & NEED_LUN) ? lunation(jd) : 0;
+  if ((n = exec(p, t, jd, e, indx, l, line, sizeof(line))) > sizeof(line)) {
+    if ((buf = malloc(n)))
+      exec(p, t, jd, e, indx, l, buf, n);
+    else
+      errno = ENOMEM;
+  }
+  if (buf)
+    fwrite(buf, 1, n, out);
+  if (buf != line)
+    free(buf);
+  unknown = p->unknown;
+  moon_fmt_free(p);
+  return buf ? unknown : -1;
+}
+
+// MOON_FORMAT  --  Write fmt, with the moon at t (whose ephemeris is e)
+// substituted, and a newline. Returns the number of unknown specifiers,
+// which are skipped, or -1 with errno EINVAL if fmt ends in a lone %, or
+// ENOMEM.
+int moon_format(FILE *out, const char *fmt, time_t t, const struct moon_ephem *e)
+{
+  return print(out, fmt, t, moon_jd(t), e, phaseindex(e->illum, e->age), NULL);
+}
+
+// MOON_FORMAT_STATE  --  moon_format() from a published state, which has
+// everything worked out already.
+int moon_format_state(FILE *out, const char *fmt, const struct moon_state *s)
+{
+  long lun = s->lunation;
+
+  return print(out, fmt, s->time, s->jd, &s->e, s->index, &lun);
+}
+
+/*
+ * The fastest each printed quantity changes, per day, over 1900-2100 with
+ * some room to spare, and the printed resolution of each.
+ */
+#define ILLUM_RATE 0.125
+#define AGE_RATE 1.25
+#define MOONDIST_RATE 5500.0 /* km */
+#define MOONANG_RATE 0.0075 /* Degrees */
+#define SUNDIST_RATE 45000.0
+#define SUNANG_RATE 0.00017
+#define MEANLUNATION 29.53058868 /* Days, as lunation() counts them */
+
+/* Seconds before v, printed to the nearest res, can print differently */
+static double until(double v, double res, double rate)
+{
+  double k = nearbyint(v / res);
+
+  return fmin(v - (k - 0.5) * res, (k + 0.5) * res - v) / rate * 86400;
+}
+
+/* Seconds before the illuminated fraction can reach a phaseindex() bound */
+static double untilindex(double illum)
+{
+  static const double bound[] = { 0.04, 0.46, 0.54, 0.96 };
+  double d = 1;
+
+  for (int i = 0; i < 4; i++)
+    d = fmin(d, fabs(illum - bound[i]));
+  return d / ILLUM_RATE * 86400;
+}
+
+// STEADY  --  Seconds from t that p can't print differently in, going by
+// how fast the moon moves, and at least one.  For %L it is the next mean
+// new moon less a margin, which can overshoot far from 1900.
+static double steady(const struct moon_fmt *p, time_t t, const struct moon_ephem *e)
+{
+  double s = 86400, jd = moon_jd(t);
+
+  for (size_t i = 0; i < p->nops; i++) {
+    switch (p->ops[i].spec) {
+      case 'E': case 'J': return 1;
+      case 'a': s = fmin(s, until(e->age, 0.1, AGE_RATE)); break;
+      case 'P': s = fmin(s, until(e->illum * 100, 0.1, ILLUM_RATE * 100)); break;
+      case 'e': case 's': case 'p': case 'N': s = fmin(s, untilindex(e->illum)); break;
+      case 'L': s = fmin(s, ((lunation(jd) + 1) * MEANLUNATION + 2415020.75933 - 0.01 - jd) * 86400); break;
+      case 'D': s = fmin(s, until(e->moondist, 1, MOONDIST_RATE)); break;
+      case 'd': s = fmin(s, until(e->moonang, 0.0001, MOONANG_RATE)); break;
+      case 'U': s = fmin(s, until(e->sundist, 1, SUNDIST_RATE)); break;
+      case 'u': s = fmin(s, until(e->sunang, 0.0001, SUNANG_RATE)); break;
+    }
+  }
+  return s < 1 ? 1 : s;
+}
+
+/* A line of output that grows as needed */
+struct line {
+  char *s;
+  size_t len, cap;
+};
+
+/* p at t into l; e is set to the ephemeris at t, which steady() wants */
+static int render(const struct moon_fmt *p, time_t t, struct moon_ephem *e, struct line *l)
+{
+  double jd = moon_jd(t);
+  int indx;
+  long lun;
+  char *s;
+
+  ephemeris(jd, e);
+  indx = phaseindex(e->illum, e->age);
+  lun = (p->need & NEED_LUN) ? lunation(jd) : 0;
+  if ((l->len = exec(p, t, jd, e, indx, lun, l->s, l->cap)) <= l->cap)
+    return 0;
+  if (!(s = realloc(l->s, l->len)))
+    return -1;
+  l->s = s, l->cap = l->len;
+  exec(p, t, jd, e, indx, lun, l->s, l->cap);
+  return 0;
+}
+
+static int same(const struct line *a, const struct line *b)
+{
+  return a->len == b->len && !memcmp(a->s, b->s, a->len);
+}
+
+/*
+ * MOON_FMT_NEXT  --  The first second after t at which p prints something
+ *		else than at t.  If it prints the same for a day, returns
+ *		the time a day after t, to look again from.  For %J and
+ *		%E it is t + 1, without rendering anything.  Returns
+ *		(time_t)-1 if out of memory.
+ */
+time_t moon_fmt_next(const struct moon_fmt *p, time_t t)
+{
+  struct moon_ephem e;
+  struct line cur = { 0 }, l = { 0 };
+  time_t lo = t, hi = t, mid;
+
+  if (p->need & NEED_SECOND)
+    return t + 1;
+  if (render(p, t, &e, &cur))
+    goto fail;
+  for (;;) {
+    lo = hi;
+    hi = lo + (time_t)steady(p, lo, &e);
+    if (hi > t + 86400)
+      hi = t + 86400;
+    if (render(p, hi, &e, &l))
+      goto fail;
+    if (!same(&l, &cur))
+      break;
+    if (hi == t + 86400)
+      goto done;
+  }
+  /* lo prints the same as t, hi doesn't; find the first second that doesn't */
+  while (hi - lo > 1) {
+    mid = lo + (hi - lo) / 2;
+    if (render(p, mid, &e, &l))
+      goto fail;
+    if (same(&l, &cur))
+      lo = mid;
+    else
+      hi = mid;
+  }
+done:
+  free(cur.s);
+  free(l.s);
+  return hi;
+
+fail:
+  free(cur.s);
+  free(l.s);
+  return (time_t)-1;
+}
+
+#define unix_to_julian(t) ((double)t / 86400.0 + 2440587.4999996666666666666)
+
+/* If you change the aspect ratio, the canned backgrounds won't work. */
+#define ASPECTRATIO 0.5
+
+static void
+putseconds(FILE *out, long secs)
+{
+  long days, hours, minutes;
+
+  days = secs / 86400;
+  secs -= days * 86400;
+  hours = secs / 3600;
+  secs -= hours * 3600;
+  minutes = secs / 60;
+  secs -= minutes * 60;
+
+  fprintf(out, "\t %ld %2ld:%02ld:%02ld", days, hours, minutes, secs);
+}
+
+#define numlines 23
+
+/*
+ * MOON_RENDER  --  phoon's picture of the moon at t, with the times since
+ *		the last quarter phase and until the next.
+ */
+void moon_render(FILE *out, time_t t)
+{
+  static char *bg[] = {
+    "                 .------------.                ",
+    "             .--'  o     . .   `--.            ",
+    "          .-'   .    O   .       . `-.         ",
+    "       .-'@   @@@@@@@   .  @@@@@      `-.      ",
+    "      /@@@  @@@@@@@@@@@   @@@@@@@   .    \\     ",
+    "    ./    o @@@@@@@@@@@   @@@@@@@       . \\.   ",
+    "   /@@  o   @@@@@@@@@@@.   @@@@@@@   O      \\  ",
+    "  /@@@@   .   @@@@@@@o    @@@@@@@@@@     @@@ \\ ",
+    "  |@@@@@               . @@@@@@@@@@@@@ o @@@@| ",
+    " /@@@@@  O  `.-./  .      @@@@@@@@@@@@    @@  \\",
+    " | @@@@    --`-'       o     @@@@@@@@ @@@@    |",
+    " |@ @@@        `    o      .  @@   . @@@@@@@  |",
+    " |       @@  @         .-.     @@@   @@@@@@@  |",
+    " \\  . @        @@@     `-'   . @@@@   @@@@  o /",
+    "  |      @@   @@@@@ .           @@   .       | ",
+    "  \\     @@@@  @\\@@    /  .  O    .     o   . / ",
+    "   \\  o  @@     \\ \\  /         .    .       /  ",
+    "    `\\     .    .\\.-.___   .      .   .-. /'   ",
+    "      \\           `-'                `-' /     ",
+    "       `-.   o   / |     o    O   .   .-'      ",
+    "          `-.   /     .       .    .-'         ",
+    "             `--.       .      .--'            ",
+    "                 `------------'                "
+  };
+  static char *qlits[] = {
+    "New Moon +",
+    "First Quarter +",
+    "Full Moon +",
+    "Last Quarter +",
+  };
+  static char *nqlits[] = {
+    "New Moon -",
+    "First Quarter -",
+    "Full Moon -",
+    "Last Quarter -",
+  };
+
+  double jd, angphase, cphase, aom;
+  double phases[2];
+  int lin, col, midlin, which;
+  double mcap, yrad, xrad, y, xright, xleft;
+  int colright, colleft;
+
+  /* Figure out the phase. */
+  jd = unix_to_julian(t);
+  angphase = phase(jd, &cphase, &aom) * 2.0 * M_PI;
+  mcap = -cos(angphase);
+
+  /* Figure out how big the moon is. */
+  yrad = numlines / 2.0;
+  xrad = yrad / ASPECTRATIO;
+
+  /* Figure out some other random stuff. */
+  midlin = numlines / 2;
+  phasehunt2(jd, phases, &which);
+
+  /* Now output the moon, a slice at a time. */
+  for (lin = 0; lin < numlines; lin = lin + 1) {
+    /* Compute the edges of this slice. */
+    y = lin + 0.5 - yrad;
+    xright = xrad * sqrt(1.0 - (y * y) / (yrad * yrad));
+    xleft = -xright;
+    if (angphase >= 0.0 && angphase < M_PI)
+      xleft = mcap * xleft;
+    else
+      xright = mcap * xright;
+    colleft = (int)(xrad + 0.5) + (int)(xleft + 0.5);
+    colright = (int)(xrad + 0.5) + (int)(xright + 0.5);
+
+
+    /* Now output the slice. */
+    for (col = 0; col < colleft; ++col)
+      putc(' ', out);
+    for (; col <= colright; ++col)
+      putc(bg[lin][col], out);
+    /* Output the end-of-line information, if any. */
+    if (lin == midlin - 2) {
+      fprintf(out, "\t %-16s", qlits[(int)(which + 0.001)]);
+    } else if (lin == midlin - 1) {
+        putseconds(out, (jd - phases[0]) * 86400);
+      } else if (lin == midlin) {
+        fprintf(out, "\t %-16s", nqlits[(int)(which + 0.001)]);
+      } else if (lin == midlin + 1) {
+        putseconds(out, (phases[1] - jd) * 86400);
+      }
+
+    putc('\n', out);
+  }
+}
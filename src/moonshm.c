@@ -0,0 +1,126 @@
+/* moonshm - the moon right now, published in shared memory
+** See LICENSE
+**
+** One process (moond -p) works out the moon every so often and publishes
+** it; any number of others read it without locks and without working
+** anything out.
+*/
+
+#include <errno.h>
+#include <fcntl.h>
+#include <math.h>
+#include <sched.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "moon.h"
+
+#define READTRIES 1000 /* Retries while the publisher is mid-write */
+
+/*
+ * MOON_STATE  --  Work out everything in a moon_state for time t.
+ *		Returns 0; every time has one.
+ */
+int moon_state(time_t t, struct moon_state *s)
+{
+  double ev[2];
+  int which;
+
+  s->jd = moon_jd(t);
+  s->time = t;
+  ephemeris(s->jd, &s->e);
+  s->index = phaseindex(s->e.illum, s->e.age);
+  s->lunation = lunation(s->jd);
+  phasehunt2(s->jd, ev, &which);
+  s->prev = ev[0];
+  s->next = ev[1];
+  s->which = which;
+  return 0;
+}
+
+/*
+ * MOONSHM_OPEN  --  Map the segment name.  A publisher, which updates it
+ *		every interval seconds, creates it if need be; readers
+ *		(interval 0) map it read-only.  Returns NULL with errno
+ *		set if the segment can't be mapped or isn't a moon_shm.
+ */
+struct moon_shm *moonshm_open(const char *name, int interval)
+{
+  struct moon_shm *m;
+  struct stat st;
+  int fd, err;
+
+  if (interval > 0) {
+    if ((fd = shm_open(name, O_RDWR | O_CREAT | O_CLOEXEC, 0644)) < 0)
+      return NULL;
+    if (ftruncate(fd, sizeof(*m))) goto fail;
+  } else if ((fd = shm_open(name, O_RDONLY | O_CLOEXEC, 0)) < 0)
+    return NULL;
+  if (fstat(fd, &st)) goto fail;
+  if ((size_t)st.st_size < sizeof(*m)) {
+    errno = EPROTO;
+    goto fail;
+  }
+  m = mmap(NULL, sizeof(*m), interval > 0 ? PROT_READ | PROT_WRITE : PROT_READ,
+      MAP_SHARED, fd, 0);
+  if (m == MAP_FAILED) goto fail;
+  close(fd);
+
+  if (interval > 0) {
+    m->version = MOONSHM_VERSION;
+    m->interval = interval;
+    __atomic_store_n(&m->magic, MOONSHM_MAGIC, __ATOMIC_RELEASE);
+  } else if (__atomic_load_n(&m->magic, __ATOMIC_ACQUIRE) != MOONSHM_MAGIC
+      || m->version != MOONSHM_VERSION) {
+    munmap(m, sizeof(*m));
+    return errno = EPROTO, NULL;
+  }
+  return m;
+
+fail:
+  err = errno;
+  close(fd);
+  errno = err;
+  return NULL;
+}
+
+void moonshm_close(struct moon_shm *m)
+{
+  munmap(m, sizeof(*m));
+}
+
+/* MOONSHM_PUBLISH  --  Replace the published state with s */
+void moonshm_publish(struct moon_shm *m, const struct moon_state *s)
+{
+  uint32_t seq = m->seq;
+
+  __atomic_store_n(&m->seq, seq + 1, __ATOMIC_RELAXED);
+  __atomic_thread_fence(__ATOMIC_RELEASE);
+  m->state = *s;
+  __atomic_store_n(&m->seq, seq + 2, __ATOMIC_RELEASE);
+}
+
+/*
+ * MOONSHM_READ  --  Copy out the published state.  Returns 0, or -1 with
+ *		errno EAGAIN if nothing has been published or the publisher
+ *		never finishes writing.
+ */
+int moonshm_read(const struct moon_shm *m, struct moon_state *s)
+{
+  uint32_t seq;
+  int i;
+
+  for (i = 0; i < READTRIES; i++) {
+    seq = __atomic_load_n(&m->seq, __ATOMIC_ACQUIRE);
+    if (seq & 1) {
+      sched_yield();
+      continue;
+    }
+    *s = m->state;
+    __atomic_thread_fence(__ATOMIC_ACQUIRE);
+    if (__atomic_load_n(&m->seq, __ATOMIC_RELAXED) == seq)
+      return seq ? 0 : (errno = EAGAIN, -1);
+  }
+  return errno = EAGAIN, -1;
+}
@@ -1,100 +1,469 @@
+#include <errno.h>
+#include <limits.h>
+#include <getopt.h>
 #include <math.h>
+#include <stdint.h>
 #include <time.h>
 #include <stdio.h>
 #include <string.h>
 #include <stdlib.h>
 #include <unistd.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/timerfd.h>
+#include <sys/uio.h>
 
-extern double phase(double pdate, double *pphase, double *mage);
-extern time_t date_parse(char *str);
-
-#define halfmonth   14.76529434    /* Half Synodic month (new Moon to full Moon) */
+#include "date_arg.h"
+#include "moon.h"
+#include "par.h"
 
 #define PI 3.14159265358979323846  /* Assume not near black hole nor in Tennessee */
 
-char *phasenames[]  = { "New", "Waxing Crescent", "First Quarter", "Waxing Gibbous", "Full", "Waning Gibbous", "Last Quarter", "Waning Crescent" };
-char *emojis[]      = {"🌑", "🌒", "🌓", "🌔", "🌕",  "🌖", "🌗", "🌘"};
-char *emojis_south[]= {"🌑", "🌘", "🌗", "🌖", "🌕",  "🌔", "🌓", "🌒"};
-
-#define HELPTXT "mprintf [-h] [-t TIME] [FORMAT]\n"
+#define HELPTXT "mprintf [-hw] [-t TIME]... [-r START END STEP] [-j THREADS] [--shm[=NAME]] [FORMAT]\n" \
+                "mprintf --annotate[=FILE] [--field=N] [--date-format=FMT] [FORMAT]\n"
 char *help = HELPTXT
+"-t print for TIME instead of now; each -t prints a line\n"
+"-r print for START to END, every STEP seconds (or STEP m, h or d)\n"
+"-j threads for -r (default one per CPU)\n"
+"-w print the moon right now again each time the output changes\n"
+"--shm read the moon right now from moond -p NAME (default "MOONSHM_NAME")\n"
+"--annotate append the moon at the time in each line of FILE (or stdin)\n"
+"--field the time is whitespace separated field N (default 1; 0 for the line)\n"
+"--date-format the time is in strptime() format FMT, at the field or line start\n"
+"Answered by moond when $MOOND_SOCKET names its socket\n"
 "-f formats:\n"
 "%a Moon Age\t %J Julian Day\n"
+"%E Unix time\t %t Tab\n"
+"%L Lunation\t %N Phase Number\n"
 "%e Emoji\t %s Emoji of phase (Southern Hemisphere)\n"
 "%p Phase Name\t %P Illuminated Percent\n"
+"%D Moon Distance (km)\t %d Moon Angular Diameter\n"
+"%U Sun Distance (km)\t %u Sun Angular Diameter\n"
 "%% Percent Sign\t %n Newline";
 
-static long jdate(struct tm *t);
-
-/* JTIME --    Convert internal GMT date and time to astronomical Julian time (i.e. Julian date plus day fraction). double jtime (struct tm *t) */
-#define jtime(t) ((jdate (t) - 0.5) + (t->tm_sec + 60 * (t->tm_min + 60 * t->tm_hour)) / 86400.0)
-
-// JDATE  --  Convert internal GMT date and time to Julian day and fraction.
-static long jdate (struct tm *t)
-{
-	long c, m, y = t->tm_year + 1900;
-
-	m = t->tm_mon + 1;
-	if (m > 2) m -= 3;
-	else { m += 9; y--; }
-	c = y / 100L;		   /* Compute century */
-	y -= 100L * c;
-	return (t->tm_mday + (c * 146097L) / 4 + (y * 1461L) / 4 + (m * 153L + 2) / 5 + 1721119L);
-}
-
-// PHASEINDEX --  Return phase based on Illuminated Fraction of the moon and age of the moon
-static int phaseindex (double ilumfrac, double mage)
-{
-  if      (ilumfrac < 0.04) return 0;
-  else if (ilumfrac > 0.96) return 4;
-  else if (ilumfrac > 0.46 && ilumfrac < 0.54) return (mage > halfmonth) ? 6 : 2;
-  else if (ilumfrac > 0.54 && ilumfrac < 0.96) return (mage > halfmonth) ? 5 : 3;
-  else    return (mage > halfmonth) ? 7 : 1;
-}
-
-void mprintf(char *fmt, double ilumfrac, double mage, struct tm *time)
-{
-  // long then = microtime();
-  int indx = phaseindex(ilumfrac, mage);
-  for (size_t i = 0; i < strlen(fmt); i++) {
-    if (fmt[i] != '%') putchar(fmt[i]);
-    else switch (fmt[++i]) {
-      case '\0':dprintf(2,"Error: Bad output formatting\n"); exit(1);
-      case '%': putchar('%'); break;
-      case 'n': putchar('\n'); break;
-      case 't': putchar('\t'); break;
-      case 'a': printf("%2.1f", mage); break;
-      case 'J': printf("%f", jtime(time)); break;
-      case 'e': fputs(emojis[indx], stdout); break;
-      case 's': fputs(emojis_south[indx], stdout); break;
-      case 'p': fputs(phasenames[indx], stdout); break;
-      case 'P': printf("%2.1f", ilumfrac*100); break;
-      case 'N': printf("%d", indx); break;
-      default : dprintf(2, "Unknown flag"); break;
+static struct option longopts[] = {
+  { "shm", optional_argument, NULL, 'S' },
+  { "annotate", optional_argument, NULL, 'A' },
+  { "field", required_argument, NULL, 'F' },
+  { "date-format", required_argument, NULL, 'D' },
+  { NULL, 0, NULL, 0 }
+};
+
+// COMPILE  --  fmt compiled, or die trying
+static struct moon_fmt *compile(const char *fmt, int *unknown)
+{
+  struct moon_fmt *p = moon_fmt_compile(fmt, unknown);
+
+  if (!p && errno == EINVAL) dprintf(2,"Error: Bad output formatting\n"), exit(1);
+  if (!p) perror("mprintf"), exit(2);
+  return p;
+}
+
+// RUN  --  p at t into *buf, which grows to fit
+static size_t run(const struct moon_fmt *p, time_t t, char **buf, size_t *cap)
+{
+  size_t n = moon_fmt_run(p, t, *buf, *cap);
+
+  if (n > *cap) {
+    if (!(*buf = realloc(*buf, *cap = n))) perror("mprintf"), exit(2);
+    moon_fmt_run(p, t, *buf, *cap);
+  }
+  return n;
+}
+
+// STEP_ARG  --  Seconds in a step like 90, 15m, 6h or 1d
+static long step_arg(const char *str)
+{
+  static const char units[] = "smhd";
+  static const long secs[] = { 1, 60, 3600, 86400 };
+  char *end, *u;
+  long n;
+
+  errno = 0;
+  n = strtol(str, &end, 10);
+  if (*end && (u = strchr(units, *end)) && n <= LONG_MAX / secs[u - units])
+    n *= secs[u - units], end++;
+  if (end == str || *end || errno || n <= 0)
+    dprintf(2, "Unknown step: `%s`\n", str), exit(2);
+  return n;
+}
+
+// OUT  --  Lines for stdout, written a large block at a time without stdio
+static char out[1 << 16];
+static size_t outlen;
+
+static void writeall(const char *s, size_t len)
+{
+  for (size_t i = 0; i < len; ) {
+    ssize_t n = write(1, s + i, len - i);
+
+    if (n < 0 && errno == EINTR) continue;
+    if (n < 0) perror("mprintf"), exit(1);
+    i += n;
+  }
+}
+
+static void flushout(void)
+{
+  writeall(out, outlen);
+  outlen = 0;
+}
+
+// EMIT  --  Add p at t to out
+static void emit(const struct moon_fmt *p, time_t t, char **buf, size_t *cap)
+{
+  size_t n = moon_fmt_run(p, t, out + outlen, sizeof(out) - outlen);
+
+  if (n <= sizeof(out) - outlen) {
+    outlen += n;
+    return;
+  }
+  flushout();
+  if (n <= sizeof(out)) outlen = moon_fmt_run(p, t, out, sizeof(out));
+  else writeall(*buf, run(p, t, buf, cap));
+}
+
+// SERIES  --  The lines of -r, worked in chunks of SERIES_LINES on a pool
+// of threads and written in order
+#define SERIES_LINES 16384
+
+struct series {
+  const struct moon_fmt *p;
+  time_t t0;
+  long step;
+  size_t n;
+};
+
+static int series_work(void *arg, size_t k, struct par_buf *b)
+{
+  const struct series *sr = arg;
+  size_t i = k * SERIES_LINES, n = sr->n - i < SERIES_LINES ? sr->n - i : SERIES_LINES, done;
+  char *s;
+
+  for (;;) {
+    b->len += moon_fmt_range(sr->p, (time_t)((uint64_t)sr->t0 + i * (uint64_t)sr->step), sr->step, n,
+        b->s + b->len, b->cap - b->len, &done);
+    if (!(n -= done)) return 0;
+    i += done;
+    if (!(s = realloc(b->s, b->cap = b->cap ? 2 * b->cap : 1 << 16))) return -1;
+    b->s = s;
+  }
+}
+
+static int series_emit(void *arg, const struct par_buf *b)
+{
+  (void)arg;
+  writeall(b->s, b->len);
+  return 0;
+}
+
+/*
+ * ANNOTATE  --  Copy lines to stdout, each with FORMAT for the time in it
+ * appended after a space.  The lines go out with writev(2) straight from
+ * the input, which is mapped or read a large block at a time, and only the
+ * annotations are written anywhere else.  A time whose text repeats isn't
+ * parsed again, and one the last annotation holds for isn't formatted
+ * again.  Lines with no time in them pass through as they are.
+ */
+#define ANNOBLOCK (1 << 20) /* Bytes per read */
+#define MAXIOV 1024
+
+static struct {
+  const struct moon_fmt *p;
+  int field; /* Whitespace separated field holding the time, or 0 for the line start */
+  const char *datefmt; /* strptime() format, or NULL for any date_parse_ctx() takes */
+  struct date_ctx dc;
+  struct iovec iov[MAXIOV];
+  int niov;
+  char arena[1 << 16]; /* Annotations */
+  size_t used;
+  char key[128]; /* Text of the last time parsed */
+  size_t keylen;
+  int keyok;
+  int keypre; /* A line need only start with key, as strptime() read no further */
+  time_t t;
+  const char *ann; /* Annotation for times from lo to hi - 1 */
+  size_t annlen;
+  time_t lo, hi, prev;
+} an = { .field = -1, .keylen = SIZE_MAX, .hi = LONG_MIN };
+
+static void anflush(void)
+{
+  struct iovec *iov = an.iov;
+  int n = an.niov;
+  ssize_t w;
+
+  while (n) {
+    if ((w = writev(1, iov, n > IOV_MAX ? IOV_MAX : n)) < 0) {
+      if (errno == EINTR) continue;
+      perror("mprintf"), exit(1);
+    }
+    for (; n && (size_t)w >= iov->iov_len; n--, iov++) w -= iov->iov_len;
+    if (n) iov->iov_base = (char *)iov->iov_base + w, iov->iov_len -= w;
+  }
+  an.niov = 0;
+  // Keep the last annotation for lines still to come
+  if (an.annlen) memmove(an.arena, an.ann, an.annlen);
+  an.ann = an.arena, an.used = an.annlen;
+}
+
+static void anpush(const char *s, size_t n)
+{
+  if (!n) return;
+  if (an.niov) {
+    struct iovec *v = &an.iov[an.niov - 1];
+
+    if ((char *)v->iov_base + v->iov_len == s) {
+      v->iov_len += n;
+      return;
+    }
+  }
+  if (an.niov == MAXIOV) anflush();
+  an.iov[an.niov++] = (struct iovec){ (void *)s, n };
+}
+
+// LINETIME  --  The time in line s of length n, if there is one
+static int linetime(const char *s, size_t n, time_t *t)
+{
+  const char *e = s + n;
+  struct tm tm = { 0 };
+  size_t len;
+
+  for (int f = 1; f <= an.field; f++) {
+    while (s < e && (*s == ' ' || *s == '\t')) s++;
+    if (f == an.field) break;
+    while (s < e && *s != ' ' && *s != '\t') s++;
+  }
+  n = e - s;
+  if (an.field) for (e = s; e < s + n && *e != ' ' && *e != '\t'; e++) ;
+  if ((len = e - s) >= sizeof(an.key)) len = sizeof(an.key) - 1;
+  if (an.keypre ? len < an.keylen || memcmp(s, an.key, an.keylen) : len != an.keylen || memcmp(s, an.key, len)) {
+    const char *r;
+
+    memcpy(an.key, s, len);
+    an.key[an.keylen = len] = 0;
+    an.keypre = 0;
+    if (an.datefmt) {
+      tm.tm_isdst = -1;
+      an.keyok = (r = strptime(an.key, an.datefmt, &tm)) && (an.t = mktime(&tm), 1);
+      // At the line start, key on what strptime() read and the byte that stopped it
+      if (an.keyok && !an.field && (size_t)(r - an.key) < len)
+        an.keypre = 1, an.keylen = r - an.key + 1;
+    } else an.keyok = len && !date_parse_ctx(an.key, &an.t, &an.dc);
+  }
+  *t = an.t;
+  return an.keyok;
+}
+
+// ANNOTATION  --  Point an.ann at the annotation for t
+static void annotation(time_t t)
+{
+  size_t n;
+
+  if (t >= an.lo && t < an.hi) return;
+  for (int tries = 0; ; tries++) {
+    char *a = an.arena + an.used;
+
+    n = moon_fmt_run(an.p, t, a + 1, sizeof(an.arena) - an.used - 1);
+    if (n < sizeof(an.arena) - an.used) {
+      *a = ' ';
+      an.ann = a, an.annlen = n + 1, an.used += n + 1;
+      break;
+    }
+    if (tries) dprintf(2, "mprintf: annotation too long\n"), exit(1);
+    an.annlen = 0;
+    anflush();
+  }
+  // Close to the last time, this one may well be followed by more
+  an.lo = t;
+  an.hi = (t - an.prev < 3600 && an.prev - t < 3600) ? moon_fmt_next(an.p, t) : t + 1;
+  an.prev = t;
+}
+
+static void anline(const char *s, size_t n)
+{
+  size_t len = n && s[n - 1] == '\n' ? n - 1 : n;
+  time_t t;
+
+  if (!linetime(s, len, &t)) {
+    anpush(s, n);
+    return;
+  }
+  annotation(t);
+  anpush(s, len);
+  anpush(an.ann, an.annlen);
+}
+
+static void annotate(const struct moon_fmt *p, const char *path)
+{
+  struct stat st;
+  char *buf = NULL, *nl;
+  size_t len = 0, cap = 0, off;
+  ssize_t n;
+  int fd = path ? open(path, O_RDONLY) : 0;
+
+  an.p = p;
+  date_ctx_init(&an.dc);
+  if (fd < 0 || fstat(fd, &st)) perror(path ? path : "stdin"), exit(2);
+  if (S_ISREG(st.st_mode) && st.st_size > 0) {
+    // The whole file at once, and the lines straight from the mapping
+    if ((buf = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0)) == MAP_FAILED)
+      perror(path ? path : "stdin"), exit(2);
+    madvise(buf, st.st_size, MADV_SEQUENTIAL);
+    for (off = 0; off < (size_t)st.st_size; off += n) {
+      nl = memchr(buf + off, '\n', st.st_size - off);
+      n = nl ? nl + 1 - (buf + off) : (ssize_t)(st.st_size - off);
+      anline(buf + off, n);
     }
+    anflush();
+    return;
+  }
+  do {
+    // Whole lines from each block; a partial one moves to the front
+    if (len == cap && !(buf = realloc(buf, cap += ANNOBLOCK))) perror("mprintf"), exit(2);
+    if ((n = read(fd, buf + len, cap - len)) < 0) {
+      if (errno == EINTR) continue;
+      perror(path ? path : "stdin"), exit(2);
+    }
+    len += n;
+    for (off = 0; (nl = memchr(buf + off, '\n', len - off)) || (!n && off < len); off = nl + 1 - buf) {
+      if (!nl) nl = buf + len - 1;
+      anline(buf + off, nl + 1 - (buf + off));
+    }
+    anflush();
+    memmove(buf, buf + off, len -= off);
+  } while (n);
+  free(buf);
+}
+
+// WATCH  --  Print fmt for the moon right now, then again whenever it
+// prints differently, sleeping until the second moon_fmt_next() says.
+static void watch(const char *fmt)
+{
+  struct itimerspec its = { 0 };
+  uint64_t n;
+  time_t t = time(0);
+  char *buf = NULL, *last = NULL;
+  size_t len, cap = 0, lastlen = 0, lastcap = 0;
+  int unknown, tfd = timerfd_create(CLOCK_REALTIME, TFD_CLOEXEC);
+  struct moon_fmt *p = compile(fmt, &unknown);
+
+  if (tfd < 0) perror("mprintf"), exit(2);
+  while (unknown--) dprintf(2, "Unknown flag");
+  for (int first = 1;; first = 0) {
+    len = run(p, t, &buf, &cap);
+    if (first || len != lastlen || memcmp(buf, last, len)) {
+      if (fwrite(buf, 1, len, stdout) != len || fflush(stdout)) exit(1);
+      // Keep this line to compare with, and reuse the last one's buffer
+      char *s = last;
+      size_t c = lastcap;
+      last = buf, lastlen = len, lastcap = cap;
+      buf = s, cap = c;
+    }
+
+    if ((its.it_value.tv_sec = moon_fmt_next(p, t)) == -1) perror("mprintf"), exit(2);
+    // Setting the clock cancels the timer, and we start again from the new time
+    if (timerfd_settime(tfd, TFD_TIMER_ABSTIME | TFD_TIMER_CANCEL_ON_SET, &its, NULL))
+      perror("mprintf"), exit(2);
+    if (read(tfd, &n, sizeof(n)) < 0 && errno != ECANCELED && errno != EINTR)
+      perror("mprintf"), exit(2);
+    t = time(0);
   }
-  putchar('\n');
-  // printf("%ld\n", microtime()-then);
 }
 
 int main (int argc, char **argv)
 {
   setvbuf(stdout, NULL, _IOFBF, 0);
-  time_t now = time(0);
+  time_t now = time(0), *times = NULL, rstart = 0, rend = 0;
+  size_t ntimes = 0, tcap = 0, nrows = 0;
+  char *shm = NULL, *anfile = NULL;
+  long rstep = 0;
+  uint64_t span;
+  int unknown, wflag = 0, rset = 0, nthreads = 0, aflag = 0;
 
   //Option parsing
-  for (int i = 0; (i = getopt (argc, argv, "ht:")) != -1; ) switch (i) {
+  for (int i = 0; (i = getopt_long (argc, argv, "hj:r:t:w", longopts, NULL)) != -1; ) switch (i) {
     case 'h': puts(help); exit(1);
-    case 't': now = date_parse(optarg); break;
+    case 't':
+      // Each -t adds a line
+      if (ntimes == tcap && !(times = realloc(times, (tcap = tcap ? 2 * tcap : 16) * sizeof(*times))))
+        perror(argv[0]), exit(2);
+      times[ntimes++] = date_arg(optarg);
+      break;
+    case 'r':
+      if (optind + 1 >= argc) puts("Error: -r takes START END STEP\n"HELPTXT), exit(1);
+      rstart = date_arg(optarg);
+      rend = date_arg(argv[optind++]);
+      rstep = step_arg(argv[optind++]);
+      // In unsigned, as END - START can be past what a time_t holds
+      span = (uint64_t)rend - (uint64_t)rstart;
+      if (rend >= rstart && span / rstep >= SIZE_MAX) puts("Error: -r takes START END STEP\n"HELPTXT), exit(1);
+      nrows = rend < rstart ? 0 : span / rstep + 1;
+      rset = 1;
+      break;
+    case 'j': if ((nthreads = atoi(optarg)) < 1) puts("Error: Bad thread count\n"HELPTXT), exit(1); break;
+    case 'w': wflag = 1; break;
+    case 'S': shm = optarg ? optarg : MOONSHM_NAME; break;
+    case 'A': aflag = 1, anfile = optarg; break;
+    case 'F': if ((an.field = atoi(optarg)) < 0) puts("Error: Bad field\n"HELPTXT), exit(1); break;
+    case 'D': an.datefmt = optarg; break;
     default: puts("Error: Unknown Option\n"HELPTXT); exit(1);
     }
 
   char *fmtstr = argv[optind] ? : "%p %e (%P%%)";
 
-  struct tm *gm = gmtime(&now);
-  if (!gm) perror(argv[0]), exit(2);
-  double cdtd = jtime(gm), ilfrac, moonage;
-  phase (cdtd, &ilfrac, &moonage);
+  if (wflag && (ntimes || rset)) puts("Error: -w watches the moon right now\n"HELPTXT), exit(1);
+  if (wflag) watch(fmtstr);
+  if (an.field < 0) an.field = an.datefmt ? 0 : 1;
+  if (aflag && (ntimes || rset)) puts("Error: --annotate takes its times from the lines\n"HELPTXT), exit(1);
+
+  // --annotate reads its times from the input, whatever moond could say
+  if (aflag) {
+    struct moon_fmt *p = compile(fmtstr, &unknown);
+    for (; unknown; unknown--) dprintf(2, "Unknown flag");
+    return annotate(p, anfile), 0;
+  }
+
+  // --shm: what moond -p published, unless it has stopped publishing
+  struct moon_shm *m;
+  struct moon_state st;
+  if (shm && !ntimes && !rset && (m = moonshm_open(shm, 0))) {
+    if (!moonshm_read(m, &st) && now - st.time <= 2 * m->interval) {
+      unknown = moon_format_state(stdout, fmtstr, &st);
+      goto done;
+    }
+    moonshm_close(m);
+  }
+  if (!ntimes && !rset) times = &now, ntimes = 1;
+
+  // With $MOOND_SOCKET set, ask moond about one time; if it can't answer,
+  // carry on alone
+  char *sock = getenv("MOOND_SOCKET"), *req, *ans;
+  size_t len;
+  if (ntimes == 1 && !rset && sock && *sock && (req = malloc(strlen(fmtstr) + 32))) {
+    sprintf(req, "FMT @%lld %s", (long long)times[0], fmtstr);
+    int r = moond_query(sock, req, &ans, &len);
+    free(req);
+    if (!r) return fwrite(ans, 1, len, stdout), free(ans), 0;
+    free(ans);
+  }
+
+  // Compile the format once for all the times
+  struct moon_fmt *p = compile(fmtstr, &unknown);
+  for (; unknown; unknown--) dprintf(2, "Unknown flag");
+  char *buf = NULL;
+  size_t cap = 0;
+  for (size_t i = 0; i < ntimes; i++)
+    emit(p, times[i], &buf, &cap);
+  flushout();
 
-  mprintf(fmtstr, ilfrac, moonage, gm);
+  // -r: in chunks on all the threads, and in order
+  struct series sr = { p, rstart, rstep, nrows };
+  if (nrows && par_run((nrows - 1) / SERIES_LINES + 1, par_threads(nthreads), series_work, series_emit, &sr))
+    perror(argv[0]), exit(2);
+done:
+  if (unknown < 0 && errno == EINVAL) dprintf(2,"Error: Bad output formatting\n"), exit(1);
+  if (unknown < 0) perror(argv[0]), exit(2);
+  while (unknown--) dprintf(2, "Unknown flag");
 }
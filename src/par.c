@@ -0,0 +1,171 @@
+/* par - a job in numbered chunks on a pool of threads, output in order
+** See LICENSE
+**
+** Workers claim chunks in order from a shared counter, so a worker that
+** finishes early always takes the oldest chunk nobody has started.  Each
+** chunk is worked into one of a ring of buffers, and the calling thread
+** hands the buffers on in chunk order.  A worker may run only so far
+** ahead of the oldest chunk not yet handed on, which bounds the memory
+** and leaves the output the same whatever the number of threads.  With
+** no output to hand on, each worker has one buffer of its own.
+*/
+
+#include <pthread.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <unistd.h>
+
+#include "par.h"
+
+#define AHEAD 4 /* Buffers per thread */
+
+struct slot {
+  struct par_buf b;
+  int ready;
+};
+
+struct job {
+  pthread_mutex_t lock;
+  pthread_cond_t space, ready;
+  size_t nchunks, next, done, nslots; /* done: chunks handed on */
+  struct slot *slots;
+  par_work *work;
+  par_emit *emit;
+  void *arg;
+  int fail;
+};
+
+/* Which worker a thread is, plus one, for par_worker() */
+static pthread_key_t self;
+static pthread_once_t self_once = PTHREAD_ONCE_INIT;
+
+static void self_init(void)
+{
+  pthread_key_create(&self, NULL);
+}
+
+struct worker {
+  struct job *j;
+  int id;
+};
+
+static void *worker(void *p)
+{
+  struct job *j = ((struct worker *)p)->j;
+  int id = ((struct worker *)p)->id, r;
+  size_t k;
+
+  pthread_setspecific(self, (void *)(intptr_t)(id + 1));
+  pthread_mutex_lock(&j->lock);
+  for (;;) {
+    while (!j->fail && j->next < j->nchunks && j->emit && j->next >= j->done + j->nslots)
+      pthread_cond_wait(&j->space, &j->lock);
+    if (j->fail || j->next >= j->nchunks)
+      break;
+    k = j->next++;
+    pthread_mutex_unlock(&j->lock);
+
+    /* With nothing to hand on to, a worker keeps to its own buffer */
+    struct slot *s = &j->slots[j->emit ? k % j->nslots : (size_t)id];
+    s->b.len = 0;
+    r = j->work(j->arg, k, &s->b);
+
+    pthread_mutex_lock(&j->lock);
+    if (r)
+      j->fail = 1, pthread_cond_broadcast(&j->space);
+    s->ready = 1;
+    pthread_cond_signal(&j->ready);
+  }
+  pthread_cond_signal(&j->ready);
+  pthread_mutex_unlock(&j->lock);
+  return NULL;
+}
+
+/*
+ * PAR_THREADS  --  want threads, or if want is 0, one per online CPU.
+ */
+int par_threads(int want)
+{
+  long n = sysconf(_SC_NPROCESSORS_ONLN);
+
+  return want > 0 ? want : n > 0 ? n : 1;
+}
+
+/*
+ * PAR_WORKER  --  The number from 0 of the pool thread calling, below
+ *		the nthreads given to par_run(), or -1 outside a pool.
+ */
+int par_worker(void)
+{
+  pthread_once(&self_once, self_init);
+  return (int)(intptr_t)pthread_getspecific(self) - 1;
+}
+
+/*
+ * PAR_RUN  --  Run work on chunks 0 to nchunks - 1 with nthreads threads,
+ *		and if emit isn't NULL, pass it every chunk's output in
+ *		order.  Returns 0, or -1 if a call stopped the job or the
+ *		threads couldn't be started.
+ */
+int par_run(size_t nchunks, int nthreads, par_work *work, par_emit *emit, void *arg)
+{
+  struct job j = { .nchunks = nchunks, .work = work, .emit = emit, .arg = arg };
+  pthread_t *th;
+  struct worker *w;
+  int started = 0;
+
+  if (nthreads < 1)
+    nthreads = 1;
+  if ((size_t)nthreads > nchunks)
+    nthreads = nchunks ? (int)nchunks : 1;
+  j.nslots = (size_t)nthreads * (emit ? AHEAD : 1);
+  th = malloc(nthreads * sizeof(*th));
+  w = malloc(nthreads * sizeof(*w));
+  if (!(j.slots = calloc(j.nslots, sizeof(*j.slots))) || !th || !w) {
+    free(j.slots), free(th), free(w);
+    return -1;
+  }
+  pthread_once(&self_once, self_init);
+  pthread_mutex_init(&j.lock, NULL);
+  pthread_cond_init(&j.space, NULL);
+  pthread_cond_init(&j.ready, NULL);
+  for (; started < nthreads; started++) {
+    w[started] = (struct worker){ &j, started };
+    if (pthread_create(&th[started], NULL, worker, &w[started]))
+      break;
+  }
+  if (!started)
+    j.fail = 1;
+
+  /* Hand on the chunks in order as they finish */
+  pthread_mutex_lock(&j.lock);
+  while (emit && !j.fail && j.done < nchunks) {
+    struct slot *s = &j.slots[j.done % j.nslots];
+
+    if (!s->ready) {
+      pthread_cond_wait(&j.ready, &j.lock);
+      continue;
+    }
+    pthread_mutex_unlock(&j.lock);
+    int r = emit(arg, &s->b);
+    pthread_mutex_lock(&j.lock);
+    s->ready = 0;
+    j.done++;
+    if (r)
+      j.fail = 1;
+    pthread_cond_broadcast(&j.space);
+  }
+  pthread_mutex_unlock(&j.lock);
+
+  while (started--)
+    pthread_join(th[started], NULL);
+  for (size_t i = 0; i < j.nslots; i++)
+    free(j.slots[i].b.s);
+  free(j.slots);
+  free(th);
+  free(w);
+  pthread_mutex_destroy(&j.lock);
+  pthread_cond_destroy(&j.space);
+  pthread_cond_destroy(&j.ready);
+  return j.fail ? -1 : 0;
+}
@@ -0,0 +1,27 @@
+/* par - a job in numbered chunks on a pool of threads, output in order
+** See LICENSE
+*/
+
+#ifndef PAR_H
+#define PAR_H
+
+#include <stddef.h>
+
+/* A chunk's output, which its buffer keeps between chunks */
+struct par_buf {
+  char *s;
+  size_t len, cap;
+};
+
+/*
+ * Called for chunk k to fill b (emptied first), and with each filled b in
+ * chunk order.  Either returns nonzero to stop the job.
+ */
+typedef int par_work(void *arg, size_t k, struct par_buf *b);
+typedef int par_emit(void *arg, const struct par_buf *b);
+
+int par_threads(int want);
+int par_worker(void); /* For work keeping state per thread */
+int par_run(size_t nchunks, int nthreads, par_work *work, par_emit *emit, void *arg);
+
+#endif
@@ -0,0 +1,117 @@
+/* phasetab - precomputed table of the quarter phases of the moon
+** See LICENSE
+**
+** mkphasetab writes the table; this file maps it and answers the same
+** question as phasehunt2() with a binary search.
+*/
+
+#include <fcntl.h>
+#include <pthread.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "phasetab.h"
+
+/*
+ * PHASETAB_OPEN  --  Map the table in path.  Returns 0, or -1 if it can't
+ *		be read or isn't a table of this version.
+ */
+int phasetab_open(struct phasetab *pt, const char *path)
+{
+  const struct phasetab_hdr *h;
+  struct stat st;
+  void *map;
+  int fd;
+
+  if ((fd = open(path, O_RDONLY)) < 0)
+    return -1;
+  if (fstat(fd, &st) || (size_t)st.st_size < sizeof(*h)) {
+    close(fd);
+    return -1;
+  }
+  map = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+  close(fd);
+  if (map == MAP_FAILED)
+    return -1;
+
+  h = map;
+  if (memcmp(h->magic, PHASETAB_MAGIC, sizeof(h->magic)) || h->version != PHASETAB_VERSION
+      || h->count < 2 || (size_t)st.st_size != sizeof(*h) + h->count * sizeof(double)) {
+    munmap(map, st.st_size);
+    return -1;
+  }
+  pt->k0 = h->k0;
+  pt->count = h->count;
+  pt->ev = (const double *)(h + 1);
+  pt->map = map;
+  pt->maplen = st.st_size;
+  return 0;
+}
+
+void phasetab_close(struct phasetab *pt)
+{
+  if (pt->map)
+    munmap(pt->map, pt->maplen);
+  memset(pt, 0, sizeof(*pt));
+}
+
+/*
+ * PHASETAB_HUNT  --  phasehunt2() from the table.  Returns 0, or -1 if
+ *		sdate isn't inside the table.
+ */
+int phasetab_hunt(const struct phasetab *pt, double sdate, double phases[2], int *which)
+{
+  size_t lo = 0, hi, mid;
+
+  if (!pt || !pt->count || !(sdate >= pt->ev[0] && sdate < pt->ev[pt->count - 1]))
+    return -1;
+
+  /* Last event at or before sdate */
+  for (hi = pt->count - 1; hi - lo > 1; )
+    if (pt->ev[mid = lo + (hi - lo) / 2] <= sdate)
+      lo = mid;
+    else
+      hi = mid;
+
+  phases[0] = pt->ev[lo];
+  phases[1] = pt->ev[lo + 1];
+  *which = lo % 4;
+  return 0;
+}
+
+#ifdef PHASETAB_EMBED
+extern const double phasetab_embedded[], phasetab_embedded_k0;
+extern const size_t phasetab_embedded_count;
+#endif
+
+static pthread_once_t defonce = PTHREAD_ONCE_INIT;
+static struct phasetab defpt;
+
+static void
+definit(void)
+{
+#ifdef PHASETAB_EMBED
+  defpt.k0 = phasetab_embedded_k0;
+  defpt.count = phasetab_embedded_count;
+  defpt.ev = phasetab_embedded;
+#else
+  char *path = getenv("MOONTAB");
+
+  if (path && *path && phasetab_open(&defpt, path))
+    memset(&defpt, 0, sizeof(defpt));
+#endif
+}
+
+/*
+ * PHASETAB_DEFAULT  --  The table phasehunt2() consults: the one built into
+ *		the program, or else the file named by $MOONTAB.  NULL if
+ *		there is neither.
+ */
+const struct phasetab *phasetab_default(void)
+{
+  pthread_once(&defonce, definit);
+  return defpt.count ? &defpt : NULL;
+}
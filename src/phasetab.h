@@ -0,0 +1,40 @@
+/* phasetab - precomputed table of the quarter phases of the moon
+** See LICENSE
+*/
+
+#ifndef PHASETAB_H
+#define PHASETAB_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#define PHASETAB_MAGIC "MOONTAB"
+#define PHASETAB_VERSION 1
+
+/*
+ * File layout: this header, then count doubles giving the times of the new
+ * moon, first quarter, full moon and last quarter of lunation k0, then of
+ * k0 + 1, and so on.  Everything is in host byte order; a table from a host
+ * of the other byte order fails the version check.
+ */
+struct phasetab_hdr {
+  char magic[8];
+  uint32_t version;
+  uint32_t count; /* Number of events */
+  double k0; /* Lunation of the first event, a new moon */
+};
+
+struct phasetab {
+  double k0;
+  size_t count;
+  const double *ev;
+  void *map; /* Mapping to release, if any */
+  size_t maplen;
+};
+
+int phasetab_open(struct phasetab *pt, const char *path);
+void phasetab_close(struct phasetab *pt);
+int phasetab_hunt(const struct phasetab *pt, double sdate, double phases[2], int *which);
+const struct phasetab *phasetab_default(void);
+
+#endif
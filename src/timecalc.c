@@ -1,19 +1,21 @@
 #include <stdio.h>
 #include <time.h>
 
-extern time_t date_parse(char *str);
+#include "date_arg.h"
 
 int main(int argc, char **argv)
 {
   if (argc < 4)
     return 1;
 
-  time_t a1 = date_parse(argv[1]);
-  time_t a2 = date_parse(argv[3]);
+  time_t a1 = date_arg(argv[1]);
+  time_t a2 = date_arg(argv[3]);
 
   a1 += (*argv[2] == '+') ? a2 : -a2;
 
-  struct tm tm = *((argc > 5) ? localtime : gmtime)(&a1);
+  struct tm tm;
+  if (!((argc > 5) ? localtime_r(&a1, &tm) : civil_tm(a1, &tm)))
+    return 1;
   tm.tm_mday--;
   tm.tm_mon--;
 
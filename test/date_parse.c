@@ -0,0 +1,323 @@
+/* date_parse - check date_parse_r() against the strptime trial loop
+** See LICENSE
+**
+** date_parse N		parse N made-up dates, N dates in a series and N
+**			made-up ISO 8601 times both ways, and the ISO times
+**			again in a batch, printing each one they disagree
+**			on, then "ok" if none
+** date_parse -t		dates parsed from several threads at once, each
+**			with a date_ctx, agree with those parsed one by one
+** date_parse DATE...	the time date_parse_r() makes of each date
+*/
+
+#include <ctype.h>
+#include <errno.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "moon.h"
+
+/* date_parse_r() as it was, a strptime() call per format */
+static char *formats[] = {
+  "%d/%m/%Y %T", "%d/%m/%Y", "%d-%b-%Y %T", "%d-%b-%Y",
+  "%d %b %Y %r", "%d %b %Y %T", "%d %b %Y %H:%M", "%d %b %Y",
+  "%a %b %d %T %Y", "%a %b %d", NULL
+};
+
+static char *ifmts[] = { "%r", "%T", "%H:%M", "%b %d %T", "%b %d", NULL };
+
+static int
+ref(const char *str, time_t *t)
+{
+  extern long timezone;
+  struct tm tm = { 0 };
+  int indx = 0;
+
+  if (*str == '@')
+    return *t = atol(str + 1), 0;
+  tzset();
+  if ((*str == '+' || *str == '-') && (str[1] != '+' && str[1] != '-')) {
+    tm.tm_year = 70;
+    tm.tm_mday = 1;
+    tm.tm_wday = 4;
+    tm.tm_zone = "UTC";
+    if (!strptime(str + 1, "%T", &tm) && !strptime(str + 1, "%H:%M", &tm) &&
+        (!strptime(str + 1, "%dd %H:%M", &tm) || !(++tm.tm_mday)))
+      return errno = EINVAL, -1;
+    time_t now = time(0);
+    now += (*str == '+') ? mktime(&tm) : -mktime(&tm);
+    return *t = now - timezone, 0;
+  }
+  while (!strptime(str, formats[indx], &tm) && formats[++indx]) ;
+  if (!formats[indx]) {
+    time_t now = time(0);
+    localtime_r(&now, &tm);
+    indx = tm.tm_hour = tm.tm_min = tm.tm_sec = 0;
+    while (!strptime(str, ifmts[indx], &tm))
+      if (!ifmts[++indx])
+        return errno = EINVAL, -1;
+    return *t = mktime(&tm), 0;
+  }
+  return *t = mktime(&tm) - timezone, 0;
+}
+
+/* Pieces of dates, right and wrong */
+static const char *words[] = {
+  "Jan", "feb", "MAR", "April", "may", "Jun", "june", "JULY", "Au", "Sept", "Oct", "Novem", "Dec", "December",
+  "Mon", "tue", "Wednesday", "THU", "Fri", "Saturday", "su", "Sund",
+  "am", "PM", "pm", "a", "d", "x", "/", "-", ":", ":", ":", " ", " ", " ", "  ", "\t", "\n", "+", "@", ".", ","
+};
+
+static unsigned long long seed = 88172645463325252ULL;
+
+static unsigned
+rnd(unsigned n)
+{
+  seed ^= seed << 13, seed ^= seed >> 7, seed ^= seed << 17;
+  return seed % n;
+}
+
+// MADEUP  --  A string near some layout, or none
+static void
+madeup(char *s, size_t size)
+{
+  static const char *shapes[] = {
+    "D/M/Y T", "D/M/Y", "D-B-Y T", "D-B-Y", "D B Y T P", "D B Y T", "D B Y N:N", "D B Y",
+    "A B D T Y", "A B D", "T P", "T", "N:N", "B D T", "B D", "+T", "-N:N", "+Dd N:N", "@N", ""
+  };
+  const char *p = shapes[rnd(sizeof(shapes) / sizeof(*shapes))];
+  size_t n = 0;
+
+  for (; *p && n + 32 < size; p++) {
+    if (!rnd(12)) {
+      // Something else in place of this piece
+      n += sprintf(s + n, rnd(2) ? "%s" : "%.1s", words[rnd(sizeof(words) / sizeof(*words))]);
+      if (rnd(2)) continue;
+    }
+    switch (*p) {
+    case 'D': case 'M': case 'N':
+      n += sprintf(s + n, rnd(3) ? "%u" : "%02u", rnd(rnd(4) ? 40 : 200));
+      break;
+    case 'Y': n += sprintf(s + n, "%u", rnd(4) ? 1900 + rnd(200) : rnd(120000)); break;
+    case 'T': n += sprintf(s + n, "%u:%02u:%u", rnd(26), rnd(62), rnd(64)); break;
+    case 'B': n += sprintf(s + n, "%s", words[rnd(14)]); break;
+    case 'A': n += sprintf(s + n, "%s", words[14 + rnd(8)]); break;
+    case 'P': n += sprintf(s + n, "%s", words[22 + rnd(4)]); break;
+    case ' ': n += sprintf(s + n, "%s", rnd(5) ? " " : words[35 + rnd(5)]); break;
+    default: s[n++] = *p;
+    }
+  }
+  s[n] = 0;
+  if (n && !rnd(8)) s[rnd(n)] = 0;
+}
+
+// SERIES  --  Date i of a series every 613 seconds from 2020, in two layouts
+static void
+series(char *s, size_t size, long i)
+{
+  time_t t = 1577836800 + i * 613;
+  struct tm tm;
+
+  strftime(s, size, i & 1 ? "%d %b %Y %H:%M" : "%d/%m/%Y %T", gmtime_r(&t, &tm));
+}
+
+// CHECK  --  Whether date_parse_r() and, with c, date_parse_ctx() parse s
+//	      as the strptime() loop does
+static int
+check(const char *s, struct date_ctx *c)
+{
+  time_t t, tc, r1, r2;
+  int e, ec, e1, e2;
+
+  // The same second before and after, for dates relative to now
+  do {
+    t = tc = r1 = r2 = 0;
+    e1 = ref(s, &r1);
+    e = date_parse_r(s, &t);
+    ec = date_parse_ctx(s, &tc, c);
+    e2 = ref(s, &r2);
+  } while (e1 != e2 || r1 != r2);
+  if (e == e1 && t == r1 && ec == e1 && tc == r1)
+    return 0;
+  printf("`%s`: %d %lld, with a date_ctx %d %lld, not %d %lld\n", s, e, (long long)t, ec, (long long)tc, e1, (long long)r1);
+  return 1;
+}
+
+/* ISO 8601 a byte at a time, and timegm() */
+static int
+isoref(const char *s, time_t *t)
+{
+  static const char pat[] = "dddd-dd-ddTdd:dd:dd";
+  static const int mdays[] = { 31, 28, 31, 30, 31, 30, 31, 31, 30, 31, 30, 31 };
+  struct tm tm = { 0 };
+  int y, mo, d, h, mi, sec, leap, hh, mm;
+
+  for (int i = 0; pat[i]; i++)
+    if (pat[i] == 'd' ? !isdigit((unsigned char)s[i]) : pat[i] == 'T' ? !s[i] || !strchr("Tt ", s[i]) : s[i] != pat[i])
+      return 0;
+  sscanf(s, "%4d-%2d-%2d%*c%2d:%2d:%2d", &y, &mo, &d, &h, &mi, &sec);
+  leap = y % 4 == 0 && (y % 100 != 0 || y % 400 == 0);
+  if (mo < 1 || mo > 12 || d < 1 || d > mdays[mo - 1] + (mo == 2 && leap) || h > 23 || mi > 59 || sec > 60)
+    return 0;
+  tm.tm_year = y - 1900, tm.tm_mon = mo - 1, tm.tm_mday = d, tm.tm_hour = h, tm.tm_min = mi, tm.tm_sec = sec;
+  s += 19;
+  if (*s == '.') {
+    if (!isdigit((unsigned char)*++s)) return 0;
+    while (isdigit((unsigned char)*s)) s++;
+  }
+  if (*s == 'Z' || *s == 'z')
+    return *t = timegm(&tm), 1;
+  if (*s == '+' || *s == '-') {
+    int n = strlen(s + 1) >= 5 && s[3] == ':' ? 5 : 4;
+    char z[6] = { 0 };
+
+    memcpy(z, s + 1, n);
+    for (int i = 0; i < n; i++)
+      if (i != 2 || n == 4 ? !isdigit((unsigned char)z[i]) : 0) return 0;
+    hh = (z[0] - '0') * 10 + z[1] - '0', mm = (z[n - 2] - '0') * 10 + z[n - 1] - '0';
+    if (hh > 23 || mm > 59) return 0;
+    return *t = timegm(&tm) - (*s == '+' ? 1 : -1) * (hh * 3600 + mm * 60), 1;
+  }
+  tm.tm_isdst = -1;
+  return *t = mktime(&tm), 1;
+}
+
+// ISOMADEUP  --  A string near ISO 8601
+static void
+isomadeup(char *s, size_t size)
+{
+  static const char *zones[] = { "", "Z", "z", "+%02u:%02u", "-%02u%02u", "+%u", "-%02u:%u", " x" };
+  size_t n = sprintf(s, "%04u-%02u-%02u%c%02u:%02u:%02u", rnd(4) ? 1900 + rnd(200) : rnd(10000),
+      rnd(14), rnd(33), "Tt x"[rnd(4) ? 0 : rnd(4)], rnd(25), rnd(62), rnd(62));
+
+  if (!rnd(3)) n += sprintf(s + n, ".%.*u", (int)rnd(4), rnd(1000));
+  n += snprintf(s + n, size - n, zones[rnd(8)], rnd(26), rnd(62));
+  if (!rnd(6)) s[rnd(n)] = "0123456789-:T .Z+"[rnd(17)];
+  if (!rnd(8)) s[rnd(n)] = 0;
+}
+
+// ISOCHECK  --  Whether date_parse_ctx() reads s as ISO 8601, or if it
+//		 isn't, as the strptime() loop does
+static int
+isocheck(const char *s, struct date_ctx *c)
+{
+  time_t t = 0, r = 0;
+  int e, e1 = 0;
+
+  if (!isoref(s, &r))
+    return check(s, c);
+  e = date_parse_ctx(s, &t, c);
+  if (e == e1 && t == r)
+    return 0;
+  printf("`%s`: %d %lld, not %d %lld\n", s, e, (long long)t, e1, (long long)r);
+  return 1;
+}
+
+// BATCH  --  Whether date_parse_batch() parses n strings laid end to end
+//	      in buf as date_parse_ctx() parses them one at a time
+static int
+batch(char (*strs)[64], int n, struct date_ctx *c)
+{
+  static char buf[64 * 256];
+  struct date_slice d[256];
+  time_t t[256], r;
+  char bad[256];
+  size_t off = 0;
+  size_t nbad, want = 0;
+  int fail = 0;
+
+  for (int i = 0; i < n; i++) {
+    d[i].s = buf + off, d[i].len = strlen(strs[i]);
+    memcpy(buf + off, strs[i], d[i].len);
+    off += d[i].len;
+  }
+  nbad = date_parse_batch(d, n, t, bad, c);
+  for (int i = 0; i < n; i++) {
+    // Dates relative to now may be a second apart
+    int e = date_parse_ctx(strs[i], &r, c), rel = strs[i][0] == '+' || strs[i][0] == '-';
+
+    want += !!e;
+    if (!e != !bad[i] || (!e && r != t[i] && !rel))
+      fail++, printf("`%s`: batch %d %lld, not %d %lld\n", strs[i], bad[i], (long long)t[i], !!e, (long long)r);
+  }
+  return fail + (nbad != want);
+}
+
+#define NTHREAD 4
+#define NDATE 20000
+
+static char dates[NDATE][64];
+static time_t ref_t[NDATE];
+static int ref_e[NDATE];
+
+static void *
+worker(void *arg)
+{
+  struct date_ctx c;
+  time_t t;
+  int *bad = arg;
+
+  date_ctx_init(&c);
+  for (int i = 0; i < NDATE; i++) {
+    t = 0;
+    int e = date_parse_ctx(dates[i], &t, &c);
+    // Again one by one, in case the second changed
+    if (e != ref_e[i] || t != ref_t[i]) {
+      time_t t1 = 0;
+      int e1 = date_parse_r(dates[i], &t1);
+      *bad |= e != e1 || t != t1;
+    }
+  }
+  return NULL;
+}
+
+int main(int argc, char **argv)
+{
+  pthread_t th[NTHREAD];
+  struct date_ctx c;
+  char s[256];
+  time_t t;
+  int bad = 0, tbad[NTHREAD] = { 0 };
+
+  date_ctx_init(&c);
+  if (argc == 2 && strspn(argv[1], "0123456789") == strlen(argv[1])) {
+    for (long i = atol(argv[1]); i > 0; i--)
+      madeup(s, sizeof(s)), bad += check(s, &c);
+    for (long i = atol(argv[1]); i > 0; i--)
+      series(s, sizeof(s), i), bad += check(s, &c);
+    for (long i = atol(argv[1]); i > 0; i--)
+      isomadeup(s, sizeof(s)), bad += isocheck(s, &c);
+    for (long i = atol(argv[1]); i > 0; i -= 256) {
+      for (int j = 0; j < 256; j++)
+        if (j % 2) isomadeup(dates[j], sizeof(dates[j]));
+        else madeup(dates[j], sizeof(dates[j]));
+      bad += batch(dates, 256, &c);
+    }
+    if (!bad)
+      puts("ok");
+    return !!bad;
+  }
+  if (argc > 1 && !strcmp(argv[1], "-t")) {
+    for (int i = 0; i < NDATE; i++) {
+      if (i % 2) madeup(dates[i], sizeof(dates[i]));
+      else series(dates[i], sizeof(dates[i]), i);
+      ref_e[i] = date_parse_r(dates[i], &ref_t[i]);
+    }
+    for (int i = 0; i < NTHREAD; i++)
+      pthread_create(&th[i], NULL, worker, &tbad[i]);
+    for (int i = 0; i < NTHREAD; i++)
+      pthread_join(th[i], NULL), bad |= tbad[i];
+    puts(bad ? "threads disagree" : "ok");
+    return bad;
+  }
+  for (int i = 1; i < argc; i++) {
+    if (date_parse_r(argv[i], &t))
+      printf("%s: %s\n", argv[i], strerror(errno));
+    else
+      printf("%lld\n", (long long)t);
+  }
+  return 0;
+}
@@ -0,0 +1,73 @@
+/* libmoon - exercise libmoon as another program would
+** See LICENSE
+**
+** libmoon DATE...	the time and illuminated fraction of each date,
+**			or why it isn't one
+** libmoon -t		the phase from several threads at once agrees with
+**			the phase from one
+*/
+
+#include <errno.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <string.h>
+
+#include "moon.h"
+
+#define NTHREAD 4
+#define NDATE 20000
+
+static double ref[NDATE];
+
+static double
+date(int i)
+{
+  return 2415020.5 + i * 7.3;
+}
+
+static void *
+worker(void *arg)
+{
+  struct moon_ephem e;
+  double ph[2];
+  int i, which, *bad = arg;
+
+  for (i = 0; i < NDATE; i++) {
+    ephemeris(date(i), &e);
+    phasehunt2(date(i), ph, &which);
+    *bad |= e.illum + ph[0] != ref[i];
+  }
+  return NULL;
+}
+
+int main(int argc, char **argv)
+{
+  pthread_t th[NTHREAD];
+  int bad[NTHREAD] = { 0 }, i, which, fail = 0;
+  struct moon_ephem e;
+  double ph[2];
+  time_t t;
+
+  if (argc > 1 && !strcmp(argv[1], "-t")) {
+    for (i = 0; i < NDATE; i++) {
+      ephemeris(date(i), &e);
+      phasehunt2(date(i), ph, &which);
+      ref[i] = e.illum + ph[0];
+    }
+    for (i = 0; i < NTHREAD; i++)
+      pthread_create(&th[i], NULL, worker, &bad[i]);
+    for (i = 0; i < NTHREAD; i++)
+      pthread_join(th[i], NULL), fail |= bad[i];
+    puts(fail ? "threads disagree" : "ok");
+    return fail;
+  }
+  for (i = 1; i < argc; i++) {
+    if (date_parse_r(argv[i], &t)) {
+      printf("%s: %s\n", argv[i], strerror(errno));
+      continue;
+    }
+    ephemeris(t / 86400.0 + 2440587.5, &e);
+    printf("%ld %.4f\n", (long)t, e.illum);
+  }
+  return 0;
+}